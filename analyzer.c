@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <pthread.h>
+#include "item.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "symbols.h"
+#include "analyzer.h"
+#include "context.h"
+
+// special form names, in the same order as the formKind values they resolve to
+char *formNames[] = {
+  "if", "cond", "let", "let*", "letrec",
+  "set!", "set-car!", "set-cdr!", "and", "or",
+  "define", "lambda", "quote"
+};
+
+// interned symbols for formNames, filled in on first use by whichever thread
+// gets there first
+Item *formSymbols[APPLY_FORM];
+Item *elseSymbol;
+pthread_once_t formSymbolsMade = PTHREAD_ONCE_INIT;
+
+void makeFormSymbols() {
+  for (int kind = 0; kind < APPLY_FORM; kind++)
+    formSymbols[kind] = intern(formNames[kind]);
+  elseSymbol = intern("else");
+}
+
+// The variables of a frame being analysed. vars lists them newest first, so
+// the variable at position i of the list lives in slot size-1-i and a later
+// binding of a name shadows an earlier one.
+typedef struct Scope {
+  Item *vars;
+  int size;
+  struct Scope *parent;
+} Scope;
+
+//prints syntax error message then ends the evaluation
+void analyzerError(char *message) {
+  fprintf(context->output, "Syntax error: %s\n", message);
+  abandon();
+}
+
+// builds a syntax node of the given kind
+Item *makeSyntax(formKind kind, Item *args) {
+  Item *node = makeItem(SYNTAX_TYPE);
+  node->sx.kind = kind;
+  node->sx.args = args;
+  return node;
+}
+
+// returns the special form a symbol names, or APPLY_FORM if it names none
+formKind formFor(Item *symbol) {
+  for (int kind = 0; kind < APPLY_FORM; kind++)
+    if (formSymbols[kind] == symbol)
+      return kind;
+  return APPLY_FORM;
+}
+
+// gives var the next slot of scope
+void declare(Scope *scope, Item *var) {
+  scope->vars = cons(var, scope->vars);
+  scope->size++;
+}
+
+// returns the slot of var in scope, or -1 if the scope does not bind it
+int slotOf(Scope *scope, Item *var) {
+  int slot = scope->size - 1;
+  for (Item *vars = scope->vars; typeOf(vars) == CONS_TYPE; vars = cdr(vars)) {
+    if (car(vars) == var)
+      return slot;
+    slot--;
+  }
+  return -1;
+}
+
+// builds a lexical address item
+Item *makeLocal(int depth, int slot, Item *name) {
+  Item *local = makeItem(LOCAL_TYPE);
+  local->la.depth = depth;
+  local->la.slot = slot;
+  local->la.name = name;
+  return local;
+}
+
+// resolves a variable to the lexical address of its innermost binding, or
+// leaves the symbol as it is if only the global frame can bind it
+Item *resolve(Scope *scope, Item *var) {
+  for (int depth = 0; scope != NULL; depth++, scope = scope->parent) {
+    int slot = slotOf(scope, var);
+    if (slot >= 0)
+      return makeLocal(depth, slot, var);
+  }
+  return var;
+}
+
+// gives a slot in scope to every variable defined at the top level of body,
+// so that the whole body sees them
+void declareDefines(Scope *scope, Item *body) {
+  for (; typeOf(body) == CONS_TYPE; body = cdr(body)) {
+    Item *expr = car(body);
+    if (typeOf(expr) == CONS_TYPE && car(expr) == formSymbols[DEFINE_FORM]
+        && typeOf(cdr(expr)) == CONS_TYPE && typeOf(car(cdr(expr))) == SYMBOL_TYPE
+        && slotOf(scope, car(cdr(expr))) < 0)
+      declare(scope, car(cdr(expr)));
+  }
+}
+
+Item *analyzeExpr(Item *expr, Scope *scope);
+
+// analyses each expression in a list, returning the list of results
+Item *analyzeList(Item *exprs, Scope *scope) {
+  Item *result = makeNull();
+  while (typeOf(exprs) == CONS_TYPE) {
+    result = cons(analyzeExpr(car(exprs), scope), result);
+    exprs = cdr(exprs);
+  }
+  if (typeOf(exprs) != NULL_TYPE)
+    analyzerError("expression list is not null-terminated");
+  return reverse(result);
+}
+
+// checks that a list of variables holds only symbols, and unless duplicate is
+// NULL, that no symbol appears twice
+void checkVariables(Item *vars, char *nonSymbol, char *duplicate) {
+  while (typeOf(vars) == CONS_TYPE) {
+    if (typeOf(car(vars)) != SYMBOL_TYPE)
+      analyzerError(nonSymbol);
+    Item *searchDup = cdr(vars);
+    while (duplicate != NULL && typeOf(searchDup) == CONS_TYPE) {
+      if (car(vars) == car(searchDup))
+        analyzerError(duplicate);
+      searchDup = cdr(searchDup);
+    }
+    vars = cdr(vars);
+  }
+}
+
+// analyses a let-style form into (frameSize exprs . body). The variables
+// take slots 0 to n-1 of the new frame in binding order, followed by any
+// variables the body defines. The init expressions of a let are analysed in
+// the enclosing scope, those of a letrec in the new one, and those of a let*
+// in the new one with only the variables bound before them visible.
+Item *analyzeLet(formKind kind, Item *args, Scope *scope) {
+  if (length(args) < 2)
+    analyzerError("too few arguments for let");
+  Item *vars = makeNull();
+  Item *inits = makeNull();
+  Item *bindings = car(args);
+  while (typeOf(bindings) == CONS_TYPE) {
+    Item *binding = car(bindings);
+    if (typeOf(binding) != CONS_TYPE || length(binding) != 2)
+      analyzerError("incorrect binding format in let");
+    vars = cons(car(binding), vars);
+    inits = cons(car(cdr(binding)), inits);
+    bindings = cdr(bindings);
+  }
+  if (typeOf(bindings) != NULL_TYPE)
+    analyzerError("binding list is not null-terminated in let");
+  vars = reverse(vars);
+  inits = reverse(inits);
+  checkVariables(vars, "tried to bind expr to non-symbol",
+                 kind != LETSTAR_FORM ? "duplicate bound variable in bind" : NULL);
+
+  Scope inner = {makeNull(), 0, scope};
+  Item *exprs = makeNull();
+  if (kind == LET_FORM)
+    exprs = analyzeList(inits, scope);
+  Item *init = inits;
+  for (; typeOf(vars) == CONS_TYPE; vars = cdr(vars), init = cdr(init)) {
+    if (kind == LETSTAR_FORM)
+      exprs = cons(analyzeExpr(car(init), &inner), exprs);
+    declare(&inner, car(vars));
+  }
+  if (kind == LETSTAR_FORM)
+    exprs = reverse(exprs);
+  else if (kind == LETREC_FORM)
+    exprs = analyzeList(inits, &inner);
+
+  declareDefines(&inner, cdr(args));
+  Item *body = analyzeList(cdr(args), &inner);
+  return cons(makeInt(inner.size), cons(exprs, body));
+}
+
+// analyses the clauses of a cond into a list of (test . body); an else clause
+// gets a test that is always true
+Item *analyzeCond(Item *clauses, Scope *scope) {
+  Item *result = makeNull();
+  while (typeOf(clauses) == CONS_TYPE) {
+    Item *clause = car(clauses);
+    if (typeOf(clause) != CONS_TYPE)
+      analyzerError("invalid clause in cond");
+    Item *test;
+    if (isNull(cdr(clauses)) && car(clause) == elseSymbol) {
+      if (isNull(cdr(clause)))
+        analyzerError("invalid clause in cond");
+      test = TRUE_ITEM;
+    } else {
+      test = analyzeExpr(car(clause), scope);
+    }
+    result = cons(cons(test, analyzeList(cdr(clause), scope)), result);
+    clauses = cdr(clauses);
+  }
+  return reverse(result);
+}
+
+// analyses a lambda into (params frameSize . body). The parameters take the
+// first slots of the call frame (a single slot holding the argument list if
+// params is a symbol), followed by any variables the body defines.
+Item *analyzeLambda(Item *args, Scope *scope) {
+  if (length(args) < 2)
+    analyzerError("not enough arguments for lambda");
+  Item *params = car(args);
+  Scope inner = {makeNull(), 0, scope};
+  if (typeOf(params) == CONS_TYPE) {
+    checkVariables(params, "parameter must be symbol", "duplicate parameter");
+    for (Item *param = params; typeOf(param) == CONS_TYPE; param = cdr(param))
+      declare(&inner, car(param));
+  } else if (typeOf(params) == SYMBOL_TYPE) {
+    declare(&inner, params);
+  } else if (typeOf(params) != NULL_TYPE) {
+    analyzerError("parameters must be list");
+  }
+  declareDefines(&inner, cdr(args));
+  Item *body = analyzeList(cdr(args), &inner);
+  return cons(params, cons(makeInt(inner.size), body));
+}
+
+// resolves a compound expression to its syntax node
+Item *analyzeForm(Item *expr, Scope *scope) {
+  formKind kind = APPLY_FORM;
+  if (typeOf(car(expr)) == SYMBOL_TYPE)
+    kind = formFor(car(expr));
+  Item *args = cdr(expr);
+
+  switch (kind) {
+  case IF_FORM:
+    if (length(args) < 3)
+      analyzerError("too few arguments to if");
+    return makeSyntax(kind, analyzeList(args, scope));
+  case COND_FORM:
+    return makeSyntax(kind, analyzeCond(args, scope));
+  case LET_FORM:
+  case LETSTAR_FORM:
+  case LETREC_FORM:
+    return makeSyntax(kind, analyzeLet(kind, args, scope));
+  case SETBANG_FORM:
+    if (length(args) != 2)
+      analyzerError("set! takes 2 arguments");
+    if (typeOf(car(args)) != SYMBOL_TYPE)
+      analyzerError("set! requires a variable");
+    return makeSyntax(kind, cons(resolve(scope, car(args)),
+                                 analyzeList(cdr(args), scope)));
+  case SETCAR_FORM:
+    if (length(args) != 2)
+      analyzerError("set-car! takes 2 arguments");
+    return makeSyntax(kind, analyzeList(args, scope));
+  case SETCDR_FORM:
+    if (length(args) != 2)
+      analyzerError("set-cdr! takes 2 arguments");
+    return makeSyntax(kind, analyzeList(args, scope));
+  case AND_FORM:
+  case OR_FORM:
+    return makeSyntax(kind, analyzeList(args, scope));
+  case DEFINE_FORM:
+    if (length(args) < 2)
+      analyzerError("too few arguments for define");
+    if (typeOf(car(args)) != SYMBOL_TYPE)
+      analyzerError("tried to bind expr to non-symbol");
+    // a define inside a body binds in that body's frame; one outside any
+    // lambda or let binds in the global frame
+    if (scope != NULL && slotOf(scope, car(args)) < 0)
+      declare(scope, car(args));
+    return makeSyntax(kind, cons(resolve(scope, car(args)),
+                                 cons(analyzeExpr(car(cdr(args)), scope), makeNull())));
+  case LAMBDA_FORM:
+    return makeSyntax(kind, analyzeLambda(args, scope));
+  case QUOTE_FORM:
+    if (length(args) != 1)
+      analyzerError("quote takes one argument");
+    return makeSyntax(kind, car(args));
+  case APPLY_FORM:
+  default:
+    return makeSyntax(APPLY_FORM, analyzeList(expr, scope));
+  }
+}
+
+// analyses a single expression; variables are resolved and other atoms are
+// left as they are
+Item *analyzeExpr(Item *expr, Scope *scope) {
+  if (typeOf(expr) == CONS_TYPE)
+    return analyzeForm(expr, scope);
+  if (typeOf(expr) == SYMBOL_TYPE)
+    return resolve(scope, expr);
+  return expr;
+}
+
+// Takes the parse tree of a program and returns a list of the analysed
+// top-level expressions.
+Item *analyze(Item *tree) {
+  pthread_once(&formSymbolsMade, makeFormSymbols);
+  return analyzeList(tree, NULL);
+}
@@ -0,0 +1,14 @@
+#include "item.h"
+
+#ifndef ANALYZER_H
+#define ANALYZER_H
+
+// Takes the parse tree of a program and returns a list of its top-level
+// expressions with every special form and application resolved to a
+// SYNTAX_TYPE node, so that eval dispatches on the node kind instead of
+// comparing symbol names. Variables bound by a lambda or let are resolved to
+// LOCAL_TYPE lexical addresses; the remaining symbols refer to the global
+// frame. Quoted data is left as it is.
+Item *analyze(Item *tree);
+
+#endif
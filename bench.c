@@ -0,0 +1,125 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "item.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "scheme.h"
+
+// Allocation benchmarks for talloc. Each one reports how many objects per
+// second the allocator hands out, collector included. The last runs a future
+// while the interpreter waits for input.
+
+#define ITEM_COUNT 20000000
+#define LIST_LENGTH 1000
+#define COLLECTIONS 5
+
+double seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+void report(char *name, long count, double elapsed) {
+    printf("%-28s %10ld allocs  %8.3f s  %8.2f M allocs/s\n",
+           name, count, elapsed, count / elapsed / 1e6);
+}
+
+// a future that allocates for a while, and the program that touches it
+#define FUTURE_PROGRAM \
+    "(define loop (lambda (n acc) (if (= n 0) acc (loop (- n 1) (cons n acc)))))" \
+    "(define count (lambda (l) (if (null? l) 0 (+ 1 (count (cdr l))))))" \
+    "(define run (lambda (k) (if (= k 0) 0 (+ (count (loop 2000 (quote ()))) (run (- k 1))))))" \
+    "(define f (future (lambda () (run 2000))))"
+#define TOUCH_PROGRAM "(touch f)"
+#define INPUT_DELAY 1
+
+// when the touch was written to the pipe
+double touchWritten;
+
+// writes the touch to the pipe once the future has had time to finish
+void *writeTouch(void *pipe) {
+    sleep(INPUT_DELAY);
+    touchWritten = seconds();
+    write(*(int *)pipe, TOUCH_PROGRAM, sizeof(TOUCH_PROGRAM) - 1);
+    close(*(int *)pipe);
+    return NULL;
+}
+
+// Starts a future, then reads a program from a pipe that stays empty for
+// INPUT_DELAY seconds. The future collects as it goes, which it can only do
+// if the reading thread lets it, so the touch that finally arrives should
+// find its value ready.
+void futureDuringInput() {
+    SchemeContext *scheme = schemeCreate(false);
+    char *output;
+    schemeEval(scheme, FUTURE_PROGRAM, &output);
+    free(output);
+    int ends[2];
+    if(pipe(ends) != 0) {
+        perror("pipe");
+        exit(1);
+    }
+    pthread_t writer;
+    pthread_create(&writer, NULL, writeTouch, &ends[1]);
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/fd/%d", ends[0]);
+    schemeLoad(scheme, path, &output);
+    double elapsed = seconds() - touchWritten;
+    pthread_join(writer, NULL);
+    close(ends[0]);
+    printf("%-28s %8.3f s after input  %s", "touch future after input", elapsed, output);
+    free(output);
+    schemeDestroy(scheme);
+}
+
+int main() {
+    tinit(__builtin_frame_address(0));
+
+    // Items that become garbage straight away
+    double start = seconds();
+    for(long i = 0; i < ITEM_COUNT; i++) {
+        Item *item = makeItem(DOUBLE_TYPE);
+        item->d = i;
+    }
+    report("items", ITEM_COUNT, seconds() - start);
+
+    // short-lived lists, the typical shape of argument lists
+    start = seconds();
+    for(long i = 0; i < ITEM_COUNT / LIST_LENGTH; i++) {
+        Item *list = makeNull();
+        for(int j = 0; j < LIST_LENGTH; j++)
+            list = cons(list, list);
+    }
+    report("cons lists", ITEM_COUNT + ITEM_COUNT / LIST_LENGTH, seconds() - start);
+
+    // raw buffers the size of typical tokens
+    start = seconds();
+    for(long i = 0; i < ITEM_COUNT; i++)
+        talloc(8 + i % 24);
+    report("raw buffers", ITEM_COUNT, seconds() - start);
+
+    // a heap of long-lived data, then one teardown of the whole thing
+    Item *keep = makeNull();
+    troot(&keep);
+    start = seconds();
+    for(long i = 0; i < ITEM_COUNT / 4; i++)
+        keep = cons(keep, keep);
+    report("live list", ITEM_COUNT / 4, seconds() - start);
+
+    // full collections over that heap, where every pointer traced is looked
+    // up among hundreds of chunks
+    start = seconds();
+    for(int i = 0; i < COLLECTIONS; i++)
+        tcollect();
+    printf("%-28s %8.3f s per collection\n", "collect, live list",
+           (seconds() - start) / COLLECTIONS);
+    start = seconds();
+    tfree();
+    printf("%-28s %8.3f s\n", "tfree", seconds() - start);
+
+    futureDuringInput();
+    return 0;
+}
@@ -0,0 +1,416 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "linkedlist.h"
+#include "talloc.h"
+#include "bignum.h"
+#include "context.h"
+
+// operands with fewer digits than this are multiplied by schoolbook
+// multiplication; larger ones are split by Karatsuba's method
+#define KARATSUBA_THRESHOLD 32
+
+// the base of a digit
+#define DIGIT_BASE ((uint64_t)1 << 32)
+
+// the largest power of ten that fits in a digit, used for decimal conversion
+#define DECIMAL_BASE 1000000000u
+#define DECIMAL_DIGITS 9
+
+// Bignum magnitudes are arrays of base 2^32 digits, least significant first.
+// The functions below work on them directly; a length never counts leading
+// zeros except where noted.
+
+void bignumError(char *message) {
+    fprintf(context->output, "Evaluation error: %s\n", message);
+    abandon();
+}
+
+// allocates scratch space outside the heap for count digits
+uint32_t *scratchDigits(int count) {
+    uint32_t *digits = malloc((count > 0 ? count : 1) * sizeof(uint32_t));
+    if(digits == NULL) bignumError("out of memory");
+    return digits;
+}
+
+// returns length less any leading zero digits
+int trim(uint32_t *digits, int length) {
+    while(length > 0 && digits[length - 1] == 0) length--;
+    return length;
+}
+
+// compares two magnitudes
+int compareDigits(uint32_t *a, int na, uint32_t *b, int nb) {
+    if(na != nb) return na < nb ? -1 : 1;
+    for(int i = na - 1; i >= 0; i--)
+        if(a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    return 0;
+}
+
+// out = a + b, where out has room for max(na, nb) + 1 digits; returns the
+// length of out, which may have a leading zero
+int addDigits(uint32_t *a, int na, uint32_t *b, int nb, uint32_t *out) {
+    if(na < nb) {
+        uint32_t *swap = a; a = b; b = swap;
+        int length = na; na = nb; nb = length;
+    }
+    uint64_t carry = 0;
+    for(int i = 0; i < na; i++) {
+        carry += (uint64_t)a[i] + (i < nb ? b[i] : 0);
+        out[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+    out[na] = (uint32_t)carry;
+    return na + 1;
+}
+
+// out = a - b, where a >= b and out has room for na digits
+void subtractDigits(uint32_t *a, int na, uint32_t *b, int nb, uint32_t *out) {
+    int64_t borrow = 0;
+    for(int i = 0; i < na; i++) {
+        int64_t difference = (int64_t)a[i] - (i < nb ? b[i] : 0) - borrow;
+        borrow = difference < 0;
+        out[i] = (uint32_t)(difference + (borrow ? (int64_t)DIGIT_BASE : 0));
+    }
+}
+
+// out += x, for an out of length digits; any digits of x beyond length must
+// be zero, as must the final carry
+void addInto(uint32_t *out, int length, uint32_t *x, int nx) {
+    uint64_t carry = 0;
+    for(int i = 0; i < length && (i < nx || carry); i++) {
+        carry += (uint64_t)out[i] + (i < nx ? x[i] : 0);
+        out[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+}
+
+// out = a * b by schoolbook multiplication; out has room for na + nb digits
+void schoolbookMultiply(uint32_t *a, int na, uint32_t *b, int nb, uint32_t *out) {
+    memset(out, 0, (na + nb) * sizeof(uint32_t));
+    for(int i = 0; i < na; i++) {
+        uint64_t carry = 0;
+        for(int j = 0; j < nb; j++) {
+            carry += (uint64_t)a[i] * b[j] + out[i + j];
+            out[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        out[i + nb] = (uint32_t)carry;
+    }
+}
+
+// out = a * b; out has room for na + nb digits. Leading zeros are allowed in
+// a and b.
+void multiplyDigits(uint32_t *a, int na, uint32_t *b, int nb, uint32_t *out) {
+    if(na < nb) {
+        uint32_t *swap = a; a = b; b = swap;
+        int length = na; na = nb; nb = length;
+    }
+    if(nb < KARATSUBA_THRESHOLD) {
+        schoolbookMultiply(a, na, b, nb, out);
+        return;
+    }
+
+    if(2 * nb <= na) {
+        // too lopsided to split evenly: multiply b by each nb-digit slice of a
+        memset(out, 0, (na + nb) * sizeof(uint32_t));
+        uint32_t *product = scratchDigits(2 * nb);
+        for(int i = 0; i < na; i += nb) {
+            int length = na - i < nb ? na - i : nb;
+            multiplyDigits(a + i, length, b, nb, product);
+            addInto(out + i, na + nb - i, product, length + nb);
+        }
+        free(product);
+        return;
+    }
+
+    // a = a1 B^m + a0 and b = b1 B^m + b0, so a b = z2 B^2m + z1 B^m + z0
+    // with z0 = a0 b0, z2 = a1 b1 and z1 = (a0 + a1)(b0 + b1) - z0 - z2
+    int m = na / 2;
+    int na1 = na - m, nb1 = nb - m;
+    uint32_t *z0 = scratchDigits(2 * m);
+    uint32_t *z2 = scratchDigits(na1 + nb1);
+    multiplyDigits(a, m, b, m, z0);
+    multiplyDigits(a + m, na1, b + m, nb1, z2);
+
+    uint32_t *sumA = scratchDigits(na1 + 1);
+    uint32_t *sumB = scratchDigits(na1 + 1);
+    int nsa = addDigits(a, m, a + m, na1, sumA);
+    int nsb = addDigits(b, m, b + m, nb1, sumB);
+    uint32_t *z1 = scratchDigits(nsa + nsb);
+    multiplyDigits(sumA, nsa, sumB, nsb, z1);
+    int nz1 = trim(z1, nsa + nsb);
+    subtractDigits(z1, nz1, z0, trim(z0, 2 * m), z1);
+    subtractDigits(z1, nz1, z2, trim(z2, na1 + nb1), z1);
+
+    memset(out, 0, (na + nb) * sizeof(uint32_t));
+    memcpy(out, z0, 2 * m * sizeof(uint32_t));
+    memcpy(out + 2 * m, z2, (na1 + nb1) * sizeof(uint32_t));
+    addInto(out + m, na + nb - m, z1, trim(z1, nz1));
+
+    free(z0);
+    free(z2);
+    free(sumA);
+    free(sumB);
+    free(z1);
+}
+
+// divides a by a single digit in place, returning the remainder
+uint32_t divideBySmall(uint32_t *a, int na, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for(int i = na - 1; i >= 0; i--) {
+        uint64_t current = (remainder << 32) | a[i];
+        a[i] = (uint32_t)(current / divisor);
+        remainder = current % divisor;
+    }
+    return (uint32_t)remainder;
+}
+
+// returns the number of leading zero bits in a nonzero digit
+int leadingZeros(uint32_t digit) {
+#ifdef __GNUC__
+    return __builtin_clz(digit);
+#else
+    int count = 0;
+    while(!(digit & 0x80000000u)) {
+        digit <<= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+// q = u / v and r = u % v by Knuth's algorithm D, where nu >= nv >= 2 and v
+// has no leading zero; q has room for nu - nv + 1 digits and r for nv
+void longDivide(uint32_t *u, int nu, uint32_t *v, int nv, uint32_t *q, uint32_t *r) {
+    // shift both so the top digit of v has its high bit set
+    int shift = leadingZeros(v[nv - 1]);
+    uint32_t *vn = scratchDigits(nv);
+    uint32_t *un = scratchDigits(nu + 1);
+    for(int i = nv - 1; i > 0; i--)
+        vn[i] = (v[i] << shift) | (shift ? (uint32_t)((uint64_t)v[i - 1] >> (32 - shift)) : 0);
+    vn[0] = v[0] << shift;
+    un[nu] = shift ? (uint32_t)((uint64_t)u[nu - 1] >> (32 - shift)) : 0;
+    for(int i = nu - 1; i > 0; i--)
+        un[i] = (u[i] << shift) | (shift ? (uint32_t)((uint64_t)u[i - 1] >> (32 - shift)) : 0);
+    un[0] = u[0] << shift;
+
+    for(int j = nu - nv; j >= 0; j--) {
+        // estimate the quotient digit from the top two digits, then correct it
+        uint64_t top = ((uint64_t)un[j + nv] << 32) | un[j + nv - 1];
+        uint64_t qhat = top / vn[nv - 1];
+        uint64_t rhat = top % vn[nv - 1];
+        while(qhat >= DIGIT_BASE
+              || qhat * vn[nv - 2] > ((rhat << 32) | un[j + nv - 2])) {
+            qhat--;
+            rhat += vn[nv - 1];
+            if(rhat >= DIGIT_BASE) break;
+        }
+
+        // subtract qhat times v from the current part of u
+        int64_t borrow = 0;
+        uint64_t carry = 0;
+        for(int i = 0; i < nv; i++) {
+            uint64_t product = qhat * vn[i] + carry;
+            carry = product >> 32;
+            int64_t difference = (int64_t)un[i + j] - (uint32_t)product - borrow;
+            borrow = difference < 0;
+            un[i + j] = (uint32_t)difference;
+        }
+        int64_t difference = (int64_t)un[j + nv] - (int64_t)carry - borrow;
+        un[j + nv] = (uint32_t)difference;
+
+        // the estimate was one too big: add v back
+        if(difference < 0) {
+            qhat--;
+            uint64_t sum = 0;
+            for(int i = 0; i < nv; i++) {
+                sum += (uint64_t)un[i + j] + vn[i];
+                un[i + j] = (uint32_t)sum;
+                sum >>= 32;
+            }
+            un[j + nv] += (uint32_t)sum;
+        }
+        q[j] = (uint32_t)qhat;
+    }
+
+    // the remainder is what is left of u, shifted back
+    for(int i = 0; i < nv; i++)
+        r[i] = (un[i] >> shift) | (shift ? (uint32_t)((uint64_t)un[i + 1] << (32 - shift)) : 0);
+    free(vn);
+    free(un);
+}
+
+// Item-level operations. A fixnum is unpacked into a sign and magnitude held
+// in a two-digit array supplied by the caller, so both kinds of integer can
+// go through the same code.
+
+// returns the sign and magnitude of an integer
+struct Bignum unpack(Item *a, uint32_t spare[2]) {
+    if(typeOf(a) == BIGNUM_TYPE)
+        return a->bn;
+    long value = intValue(a);
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    spare[0] = (uint32_t)magnitude;
+    spare[1] = (uint32_t)(magnitude >> 32);
+    return (struct Bignum){spare, trim(spare, 2), value < 0};
+}
+
+// makes the integer with the given sign and magnitude, taking ownership of
+// digits, which must be heap memory
+Item *normalize(uint32_t *digits, int length, bool negative) {
+    length = trim(digits, length);
+    if(length <= 2) {
+        uint64_t magnitude = length == 0 ? 0 : digits[0];
+        if(length == 2) magnitude |= (uint64_t)digits[1] << 32;
+        if(negative ? magnitude <= (uint64_t)FIXNUM_MAX + 1 : magnitude <= (uint64_t)FIXNUM_MAX)
+            return makeInt(negative ? -(long)(magnitude - 1) - 1 : (long)magnitude);
+    }
+    Item *result = makeItem(BIGNUM_TYPE);
+    result->bn.digits = digits;
+    result->bn.length = length;
+    result->bn.negative = negative;
+    return result;
+}
+
+// allocates heap digits for a result
+uint32_t *resultDigits(int count) {
+    return talloc((count > 0 ? count : 1) * sizeof(uint32_t));
+}
+
+// adds a and b, negating b first if subtract is set
+Item *addSigned(Item *a, Item *b, bool subtract) {
+    uint32_t spareA[2], spareB[2];
+    struct Bignum x = unpack(a, spareA);
+    struct Bignum y = unpack(b, spareB);
+    if(subtract) y.negative = !y.negative;
+
+    int capacity = (x.length > y.length ? x.length : y.length) + 1;
+    uint32_t *digits = resultDigits(capacity);
+    if(x.negative == y.negative) {
+        addDigits(x.digits, x.length, y.digits, y.length, digits);
+        return normalize(digits, capacity, x.negative);
+    }
+    // opposite signs: subtract the smaller magnitude from the larger
+    if(compareDigits(x.digits, x.length, y.digits, y.length) >= 0) {
+        subtractDigits(x.digits, x.length, y.digits, y.length, digits);
+        return normalize(digits, x.length, x.negative);
+    }
+    subtractDigits(y.digits, y.length, x.digits, x.length, digits);
+    return normalize(digits, y.length, y.negative);
+}
+
+Item *integerAdd(Item *a, Item *b) {
+    return addSigned(a, b, false);
+}
+
+Item *integerSubtract(Item *a, Item *b) {
+    return addSigned(a, b, true);
+}
+
+Item *integerMultiply(Item *a, Item *b) {
+    uint32_t spareA[2], spareB[2];
+    struct Bignum x = unpack(a, spareA);
+    struct Bignum y = unpack(b, spareB);
+    if(x.length == 0 || y.length == 0)
+        return makeInt(0);
+    uint32_t *digits = resultDigits(x.length + y.length);
+    multiplyDigits(x.digits, x.length, y.digits, y.length, digits);
+    return normalize(digits, x.length + y.length, x.negative != y.negative);
+}
+
+void integerDivide(Item *a, Item *b, Item **quotient, Item **remainder) {
+    uint32_t spareA[2], spareB[2];
+    struct Bignum x = unpack(a, spareA);
+    struct Bignum y = unpack(b, spareB);
+    if(compareDigits(x.digits, x.length, y.digits, y.length) < 0) {
+        *quotient = makeInt(0);
+        *remainder = a;
+        return;
+    }
+    uint32_t *q = resultDigits(x.length);
+    uint32_t *r = resultDigits(y.length);
+    if(y.length == 1) {
+        memcpy(q, x.digits, x.length * sizeof(uint32_t));
+        r[0] = divideBySmall(q, x.length, y.digits[0]);
+    } else {
+        memset(q, 0, x.length * sizeof(uint32_t));
+        longDivide(x.digits, x.length, y.digits, y.length, q, r);
+    }
+    // normalize may allocate, so the quotient is kept where the collector
+    // can see it before the remainder is made
+    *quotient = normalize(q, x.length, x.negative != y.negative);
+    *remainder = normalize(r, y.length, x.negative);
+}
+
+int integerCompare(Item *a, Item *b) {
+    if(typeOf(a) == INT_TYPE && typeOf(b) == INT_TYPE)
+        return (intValue(a) > intValue(b)) - (intValue(a) < intValue(b));
+    uint32_t spareA[2], spareB[2];
+    struct Bignum x = unpack(a, spareA);
+    struct Bignum y = unpack(b, spareB);
+    if(x.negative != y.negative)
+        return x.negative ? -1 : 1;
+    int order = compareDigits(x.digits, x.length, y.digits, y.length);
+    return x.negative ? -order : order;
+}
+
+double integerToDouble(Item *a) {
+    if(typeOf(a) == INT_TYPE)
+        return (double)intValue(a);
+    double result = 0;
+    for(int i = a->bn.length - 1; i >= 0; i--)
+        result = result * (double)DIGIT_BASE + a->bn.digits[i];
+    return a->bn.negative ? -result : result;
+}
+
+Item *integerFromDecimal(char *text, size_t length, bool negative) {
+    // each group of nine decimal digits needs at most one more binary digit
+    int capacity = (int)(length / DECIMAL_DIGITS) + 2;
+    uint32_t *digits = resultDigits(capacity);
+    memset(digits, 0, capacity * sizeof(uint32_t));
+    int used = 0;
+    for(size_t start = 0; start < length;) {
+        // take the leading digits so that the rest come in groups of nine
+        size_t group = (length - start) % DECIMAL_DIGITS;
+        if(group == 0) group = DECIMAL_DIGITS;
+        uint32_t chunk = 0, scale = 1;
+        for(size_t i = 0; i < group; i++) {
+            chunk = 10 * chunk + (text[start + i] - '0');
+            scale *= 10;
+        }
+        start += group;
+        // digits = digits * scale + chunk
+        uint64_t carry = chunk;
+        for(int i = 0; i < used; i++) {
+            carry += (uint64_t)digits[i] * scale;
+            digits[i] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if(carry) digits[used++] = (uint32_t)carry;
+    }
+    return normalize(digits, capacity, negative);
+}
+
+void printInteger(FILE *stream, Item *a) {
+    if(typeOf(a) == INT_TYPE) {
+        fprintf(stream, "%ld", intValue(a));
+        return;
+    }
+    // peel off nine decimal digits at a time, least significant first
+    int length = a->bn.length;
+    uint32_t *digits = scratchDigits(length);
+    memcpy(digits, a->bn.digits, length * sizeof(uint32_t));
+    uint32_t *groups = scratchDigits(length * 2 + 1);
+    // a bignum has at least one digit, so there is always a first group
+    int count = 0;
+    do {
+        groups[count++] = divideBySmall(digits, length, DECIMAL_BASE);
+        length = trim(digits, length);
+    } while(length > 0);
+    fprintf(stream, "%s%u", a->bn.negative ? "-" : "", groups[count - 1]);
+    for(int i = count - 2; i >= 0; i--)
+        fprintf(stream, "%09u", groups[i]);
+    free(digits);
+    free(groups);
+}
@@ -0,0 +1,33 @@
+#include <stddef.h>
+#include <stdio.h>
+#include "item.h"
+
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+// Exact integers of any size. Every function here takes integer items, either
+// fixnums or bignums, and returns a fixnum whenever the result fits in one, so
+// a bignum is always bigger than any fixnum.
+
+Item *integerAdd(Item *a, Item *b);
+Item *integerSubtract(Item *a, Item *b);
+Item *integerMultiply(Item *a, Item *b);
+
+// Divides a by b, which must not be zero, truncating towards zero. The
+// remainder has the sign of a.
+void integerDivide(Item *a, Item *b, Item **quotient, Item **remainder);
+
+// Returns a negative number, zero or a positive number as a is less than,
+// equal to or greater than b.
+int integerCompare(Item *a, Item *b);
+
+// Returns the double nearest to an integer.
+double integerToDouble(Item *a);
+
+// Makes the integer written as length decimal digits at text.
+Item *integerFromDecimal(char *text, size_t length, bool negative);
+
+// Prints an integer in decimal to stream.
+void printInteger(FILE *stream, Item *a);
+
+#endif
@@ -0,0 +1,559 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "item.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "symbols.h"
+#include "tokenizer.h"
+#include "parser.h"
+#include "analyzer.h"
+#include "vector.h"
+#include "context.h"
+#include "cache.h"
+
+// the version of the analyzer's output and of this format; changes whenever
+// either does, so that caches written by an older interpreter are not used
+#define CACHE_VERSION 1
+
+// Each item is written as one of these tags followed by its contents. A
+// proper or improper list is written as its length, its elements and then
+// its tail, so reading it back does not recurse down the spine. A symbol is
+// written as its index in the order symbols first appear in the cache, and
+// the first time also as its name.
+enum {
+  TAG_END, TAG_NULL, TAG_TRUE, TAG_FALSE, TAG_VOID, TAG_INT, TAG_DOUBLE,
+  TAG_STRING, TAG_SYMBOL, TAG_LIST, TAG_SYNTAX, TAG_LOCAL, TAG_BIGNUM,
+  TAG_VECTOR
+};
+
+typedef struct CacheHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t itemSize;
+  uint64_t sourceHash;
+  uint64_t sourceLength;
+  // a hash of everything after the header, so a damaged cache is not used
+  uint64_t contentHash;
+} CacheHeader;
+
+static const char cacheMagic[8] = "SCMCACHE";
+
+struct Cache {
+  // when reading: the mapped cache file, where the next item starts, and the
+  // symbols seen so far
+  bool reading;
+  unsigned char *map;
+  size_t mapSize;
+  const unsigned char *at;
+  const unsigned char *end;
+  bool failed;
+  Item **symbols;
+  size_t symbolCount;
+  size_t symbolCapacity;
+
+  // when recording: where the cache goes, the header it will have, the
+  // items written so far, and the index of each symbol written, in an
+  // open-addressed map keyed by the symbol's address
+  char *path;
+  CacheHeader header;
+  unsigned char *data;
+  size_t size;
+  size_t capacity;
+  Item **symbolKeys;
+  size_t *symbolIndexes;
+  size_t symbolSlots;
+  bool finished;
+};
+
+// prints error message and exits
+void cacheAllocationError() {
+  printf("Allocation error: out of memory\n");
+  exit(1);
+}
+
+// hashes the length bytes of text, a word at a time
+static uint64_t hashText(const char *text, size_t length) {
+  uint64_t hash = 0x9e3779b97f4a7c15ULL ^ length;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, text + i, sizeof(word));
+    hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 32;
+  }
+  uint64_t last = 0;
+  memcpy(&last, text + i, length - i);
+  hash = (hash ^ last) * 0xc4ceb9fe1a85ec53ULL;
+  return hash ^ (hash >> 29);
+}
+
+// writing
+
+static void putBytes(struct Cache *cache, const void *bytes, size_t size) {
+  if (cache->size + size > cache->capacity) {
+    size_t capacity = cache->capacity ? 2 * cache->capacity : 4096;
+    while (capacity < cache->size + size)
+      capacity *= 2;
+    cache->data = realloc(cache->data, capacity);
+    if (cache->data == NULL)
+      cacheAllocationError();
+    cache->capacity = capacity;
+  }
+  memcpy(cache->data + cache->size, bytes, size);
+  cache->size += size;
+}
+
+static void putByte(struct Cache *cache, unsigned char byte) {
+  putBytes(cache, &byte, 1);
+}
+
+// writes a number seven bits at a time, lowest first, with the top bit of
+// each byte set if more follow
+static void putNumber(struct Cache *cache, uint64_t number) {
+  while (number >= 0x80) {
+    putByte(cache, (number & 0x7f) | 0x80);
+    number >>= 7;
+  }
+  putByte(cache, number);
+}
+
+static size_t symbolSlot(struct Cache *cache, Item *symbol) {
+  size_t slot = ((uintptr_t)symbol >> 4) * 0x9e3779b97f4a7c15ULL & (cache->symbolSlots - 1);
+  while (cache->symbolKeys[slot] != NULL && cache->symbolKeys[slot] != symbol)
+    slot = (slot + 1) & (cache->symbolSlots - 1);
+  return slot;
+}
+
+// writes a symbol's index, and its name if it has not been written before
+static void putSymbol(struct Cache *cache, Item *symbol) {
+  if (2 * (cache->symbolCount + 1) > cache->symbolSlots) {
+    Item **keys = cache->symbolKeys;
+    size_t *indexes = cache->symbolIndexes;
+    size_t slots = cache->symbolSlots;
+    cache->symbolSlots = slots ? 2 * slots : 256;
+    cache->symbolKeys = calloc(cache->symbolSlots, sizeof(Item *));
+    cache->symbolIndexes = malloc(cache->symbolSlots * sizeof(size_t));
+    if (cache->symbolKeys == NULL || cache->symbolIndexes == NULL)
+      cacheAllocationError();
+    for (size_t i = 0; i < slots; i++) {
+      if (keys[i] != NULL) {
+        size_t slot = symbolSlot(cache, keys[i]);
+        cache->symbolKeys[slot] = keys[i];
+        cache->symbolIndexes[slot] = indexes[i];
+      }
+    }
+    free(keys);
+    free(indexes);
+  }
+  size_t slot = symbolSlot(cache, symbol);
+  putByte(cache, TAG_SYMBOL);
+  if (cache->symbolKeys[slot] != NULL) {
+    putNumber(cache, cache->symbolIndexes[slot]);
+    return;
+  }
+  cache->symbolKeys[slot] = symbol;
+  cache->symbolIndexes[slot] = cache->symbolCount;
+  putNumber(cache, cache->symbolCount++);
+  size_t length = strlen(symbol->s);
+  putNumber(cache, length);
+  putBytes(cache, symbol->s, length);
+}
+
+// writes an item, or marks the cache failed if it holds something a program's
+// text cannot
+static void putItem(struct Cache *cache, Item *item) {
+  switch (typeOf(item)) {
+  case NULL_TYPE:
+    putByte(cache, TAG_NULL);
+    break;
+  case BOOL_TYPE:
+    putByte(cache, boolValue(item) ? TAG_TRUE : TAG_FALSE);
+    break;
+  case VOID_TYPE:
+    putByte(cache, TAG_VOID);
+    break;
+  case INT_TYPE: {
+    long value = intValue(item);
+    putByte(cache, TAG_INT);
+    putNumber(cache, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+    break;
+  }
+  case DOUBLE_TYPE:
+    putByte(cache, TAG_DOUBLE);
+    putBytes(cache, &item->d, sizeof(double));
+    break;
+  case STR_TYPE: {
+    size_t length = strlen(item->s);
+    putByte(cache, TAG_STRING);
+    putNumber(cache, length);
+    putBytes(cache, item->s, length);
+    break;
+  }
+  case SYMBOL_TYPE:
+    putSymbol(cache, item);
+    break;
+  case CONS_TYPE: {
+    size_t length = 0;
+    Item *tail = item;
+    for (; typeOf(tail) == CONS_TYPE; tail = cdr(tail))
+      length++;
+    putByte(cache, TAG_LIST);
+    putNumber(cache, length);
+    for (Item *rest = item; typeOf(rest) == CONS_TYPE; rest = cdr(rest))
+      putItem(cache, car(rest));
+    putItem(cache, tail);
+    break;
+  }
+  case SYNTAX_TYPE:
+    putByte(cache, TAG_SYNTAX);
+    putByte(cache, item->sx.kind);
+    putItem(cache, item->sx.args);
+    break;
+  case LOCAL_TYPE:
+    putByte(cache, TAG_LOCAL);
+    putNumber(cache, item->la.depth);
+    putNumber(cache, item->la.slot);
+    putItem(cache, item->la.name);
+    break;
+  case BIGNUM_TYPE:
+    putByte(cache, TAG_BIGNUM);
+    putByte(cache, item->bn.negative);
+    putNumber(cache, item->bn.length);
+    putBytes(cache, item->bn.digits, item->bn.length * sizeof(uint32_t));
+    break;
+  case VECTOR_TYPE:
+    putByte(cache, TAG_VECTOR);
+    putNumber(cache, item->vec.length);
+    for (int i = 0; i < item->vec.length; i++)
+      putItem(cache, item->vec.elements[i]);
+    break;
+  default:
+    cache->failed = true;
+    break;
+  }
+}
+
+// reading
+
+static bool takeBytes(struct Cache *cache, void *bytes, size_t size) {
+  if ((size_t)(cache->end - cache->at) < size) {
+    cache->failed = true;
+    return false;
+  }
+  memcpy(bytes, cache->at, size);
+  cache->at += size;
+  return true;
+}
+
+static unsigned char takeByte(struct Cache *cache) {
+  unsigned char byte = TAG_END;
+  takeBytes(cache, &byte, 1);
+  return byte;
+}
+
+static uint64_t takeNumber(struct Cache *cache) {
+  uint64_t number = 0;
+  for (int shift = 0; shift < 64 && !cache->failed; shift += 7) {
+    unsigned char byte = takeByte(cache);
+    number |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return number;
+  }
+  cache->failed = true;
+  return 0;
+}
+
+// takes a count of things at least a byte each, failing if there cannot be
+// that many left
+static size_t takeCount(struct Cache *cache) {
+  uint64_t count = takeNumber(cache);
+  if (count > (uint64_t)(cache->end - cache->at) || count > INT32_MAX) {
+    cache->failed = true;
+    return 0;
+  }
+  return count;
+}
+
+static Item *takeSymbol(struct Cache *cache) {
+  size_t index = takeNumber(cache);
+  if (index < cache->symbolCount)
+    return cache->symbols[index];
+  size_t length = takeCount(cache);
+  if (index != cache->symbolCount || cache->failed)
+    return NULL;
+  if (cache->symbolCount == cache->symbolCapacity) {
+    cache->symbolCapacity = cache->symbolCapacity ? 2 * cache->symbolCapacity : 256;
+    cache->symbols = realloc(cache->symbols, cache->symbolCapacity * sizeof(Item *));
+    if (cache->symbols == NULL)
+      cacheAllocationError();
+  }
+  Item *symbol = internSpan((char *)cache->at, length);
+  cache->at += length;
+  cache->symbols[cache->symbolCount++] = symbol;
+  return symbol;
+}
+
+// Reads an item. Without build, it only checks that the item is well formed,
+// returning VOID_ITEM in place of anything it would allocate, so that a
+// cache can be checked whole before anything is evaluated. Returns NULL, and
+// marks the cache failed, if the item is malformed.
+static Item *takeItem(struct Cache *cache, bool build) {
+  unsigned char tag = takeByte(cache);
+  if (cache->failed)
+    return NULL;
+  switch (tag) {
+  case TAG_NULL:
+    return makeNull();
+  case TAG_TRUE:
+    return TRUE_ITEM;
+  case TAG_FALSE:
+    return FALSE_ITEM;
+  case TAG_VOID:
+    return VOID_ITEM;
+  case TAG_INT: {
+    uint64_t number = takeNumber(cache);
+    return makeInt((long)(number >> 1) ^ -(long)(number & 1));
+  }
+  case TAG_DOUBLE: {
+    double value;
+    if (!takeBytes(cache, &value, sizeof(value)) || !build)
+      return VOID_ITEM;
+    Item *item = makeItem(DOUBLE_TYPE);
+    item->d = value;
+    return item;
+  }
+  case TAG_STRING: {
+    size_t length = takeCount(cache);
+    if (cache->failed)
+      return NULL;
+    const unsigned char *text = cache->at;
+    cache->at += length;
+    if (!build)
+      return VOID_ITEM;
+    Item *item = makeItem(STR_TYPE);
+    item->s = talloc(length + 1);
+    memcpy(item->s, text, length);
+    item->s[length] = '\0';
+    return item;
+  }
+  case TAG_SYMBOL:
+    return takeSymbol(cache);
+  case TAG_LIST: {
+    size_t length = takeCount(cache);
+    if (length == 0)
+      cache->failed = true;
+    Item *list = makeNull();
+    Item *last = NULL;
+    for (size_t i = 0; i < length && !cache->failed; i++) {
+      Item *element = takeItem(cache, build);
+      if (!build)
+        continue;
+      Item *pair = cons(element, makeNull());
+      if (last == NULL)
+        list = pair;
+      else
+        last->c.cdr = pair;
+      last = pair;
+    }
+    Item *tail = takeItem(cache, build);
+    if (cache->failed)
+      return NULL;
+    if (!build)
+      return VOID_ITEM;
+    last->c.cdr = tail;
+    return list;
+  }
+  case TAG_SYNTAX: {
+    formKind kind = takeByte(cache);
+    if (kind > APPLY_FORM)
+      cache->failed = true;
+    Item *args = takeItem(cache, build);
+    if (cache->failed)
+      return NULL;
+    if (!build)
+      return VOID_ITEM;
+    Item *item = makeItem(SYNTAX_TYPE);
+    item->sx.kind = kind;
+    item->sx.args = args;
+    return item;
+  }
+  case TAG_LOCAL: {
+    int depth = takeCount(cache);
+    int slot = takeNumber(cache);
+    Item *name = takeItem(cache, build);
+    if (cache->failed)
+      return NULL;
+    if (!build)
+      return VOID_ITEM;
+    Item *item = makeItem(LOCAL_TYPE);
+    item->la.depth = depth;
+    item->la.slot = slot;
+    item->la.name = name;
+    return item;
+  }
+  case TAG_BIGNUM: {
+    bool negative = takeByte(cache);
+    size_t length = takeCount(cache);
+    if (cache->failed || (size_t)(cache->end - cache->at) < length * sizeof(uint32_t))
+      cache->failed = true;
+    if (cache->failed)
+      return NULL;
+    const unsigned char *digits = cache->at;
+    cache->at += length * sizeof(uint32_t);
+    if (!build)
+      return VOID_ITEM;
+    Item *item = makeItem(BIGNUM_TYPE);
+    item->bn.digits = talloc((length > 0 ? length : 1) * sizeof(uint32_t));
+    memcpy(item->bn.digits, digits, length * sizeof(uint32_t));
+    item->bn.length = length;
+    item->bn.negative = negative;
+    return item;
+  }
+  case TAG_VECTOR: {
+    size_t length = takeCount(cache);
+    Item *vector = build ? makeVector(length, VOID_ITEM) : VOID_ITEM;
+    for (size_t i = 0; i < length && !cache->failed; i++) {
+      Item *element = takeItem(cache, build);
+      if (build)
+        vector->vec.elements[i] = element;
+    }
+    return cache->failed ? NULL : vector;
+  }
+  default:
+    cache->failed = true;
+    return NULL;
+  }
+}
+
+// returns the path of the cache of the file at path
+static char *cachePathFor(const char *path) {
+  char *cachePath = malloc(strlen(path) + sizeof(".cache"));
+  if (cachePath == NULL)
+    cacheAllocationError();
+  strcpy(cachePath, path);
+  strcat(cachePath, ".cache");
+  return cachePath;
+}
+
+// maps the cache at cachePath and checks it matches header and is well formed
+// throughout, returning false if not
+static bool mapCache(struct Cache *cache, const char *cachePath, CacheHeader *header) {
+  int file = open(cachePath, O_RDONLY);
+  if (file < 0)
+    return false;
+  struct stat info;
+  void *map = MAP_FAILED;
+  if (fstat(file, &info) == 0 && (size_t)info.st_size > sizeof(CacheHeader))
+    map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+  close(file);
+  if (map == MAP_FAILED)
+    return false;
+  cache->map = map;
+  cache->mapSize = info.st_size;
+  CacheHeader *found = map;
+  if (memcmp(found, header, offsetof(CacheHeader, contentHash)) != 0
+      || found->contentHash != hashText((char *)cache->map + sizeof(CacheHeader),
+                                        cache->mapSize - sizeof(CacheHeader)))
+    return false;
+
+  cache->at = cache->map + sizeof(CacheHeader);
+  cache->end = cache->map + cache->mapSize;
+  while (!cache->failed && cache->at < cache->end && *cache->at != TAG_END)
+    takeItem(cache, false);
+  if (cache->failed || cache->at + 1 != cache->end)
+    return false;
+
+  // read again from the start, building this time
+  cache->at = cache->map + sizeof(CacheHeader);
+  cache->symbolCount = 0;
+  return true;
+}
+
+struct Cache *openCache() {
+  const char *path;
+  size_t length;
+  const char *text = mappedInput(&path, &length);
+  if (text == NULL)
+    return NULL;
+  struct Cache *cache = calloc(1, sizeof(struct Cache));
+  if (cache == NULL)
+    cacheAllocationError();
+  memcpy(cache->header.magic, cacheMagic, sizeof(cache->header.magic));
+  cache->header.version = CACHE_VERSION;
+  cache->header.itemSize = sizeof(Item);
+  cache->header.sourceHash = hashText(text, length);
+  cache->header.sourceLength = length;
+  cache->path = cachePathFor(path);
+
+  cache->reading = mapCache(cache, cache->path, &cache->header);
+  if (!cache->reading) {
+    if (cache->map != NULL)
+      munmap(cache->map, cache->mapSize);
+    cache->map = NULL;
+    cache->failed = false;
+    cache->symbolCount = 0;
+  }
+  return cache;
+}
+
+Item *nextTree(struct Cache *cache) {
+  if (cache != NULL && cache->reading) {
+    if (*cache->at == TAG_END)
+      return NULL;
+    return takeItem(cache, true);
+  }
+  Item *datum = readDatum();
+  if (datum == NULL) {
+    if (cache != NULL)
+      cache->finished = true;
+    return NULL;
+  }
+  Item *tree = analyze(cons(datum, makeNull()));
+  // written before it is evaluated, which may change quoted data in it
+  if (cache != NULL && !cache->failed)
+    putItem(cache, tree);
+  return tree;
+}
+
+// writes a recorded cache out, to a temporary file first so that no reader
+// ever sees part of one; a cache that cannot be written is simply left out
+static void writeCache(struct Cache *cache) {
+  putByte(cache, TAG_END);
+  char *temporary = malloc(strlen(cache->path) + sizeof(".tmp"));
+  if (temporary == NULL)
+    cacheAllocationError();
+  strcpy(temporary, cache->path);
+  strcat(temporary, ".tmp");
+  cache->header.contentHash = hashText((char *)cache->data, cache->size);
+  FILE *file = fopen(temporary, "wb");
+  if (file != NULL) {
+    bool written = fwrite(&cache->header, sizeof(CacheHeader), 1, file) == 1
+                   && fwrite(cache->data, 1, cache->size, file) == cache->size;
+    if (fclose(file) == 0 && written)
+      rename(temporary, cache->path);
+    else
+      unlink(temporary);
+  }
+  free(temporary);
+}
+
+void closeCache(struct Cache *cache) {
+  if (cache == NULL)
+    return;
+  if (!cache->reading && cache->finished && !cache->failed)
+    writeCache(cache);
+  if (cache->map != NULL)
+    munmap(cache->map, cache->mapSize);
+  free(cache->symbols);
+  free(cache->path);
+  free(cache->data);
+  free(cache->symbolKeys);
+  free(cache->symbolIndexes);
+  free(cache);
+}
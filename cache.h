@@ -0,0 +1,26 @@
+#include "item.h"
+
+#ifndef CACHE_H
+#define CACHE_H
+
+// A program read from a file has its analysed top-level expressions saved
+// next to it, in the file's path with ".cache" added. A later run finds them
+// there, keyed by a hash of the source and the version of the analyzer, and
+// takes them from the cache instead of tokenizing, parsing and analysing the
+// source again.
+struct Cache;
+
+// Opens the cache of the current input: one to take its expressions from if
+// there is a current one, else one recording them as they are analysed if the
+// input is a file, else NULL.
+struct Cache *openCache();
+
+// Returns the next analysed top-level expression of the current input, in
+// the form analyze gives it, or NULL after the last. cache may be NULL.
+Item *nextTree(struct Cache *cache);
+
+// Frees a cache, first writing out what it recorded if the whole input was
+// read and analysed without error.
+void closeCache(struct Cache *cache);
+
+#endif
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "item.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "vm.h"
+#include "compiler.h"
+#include "context.h"
+
+// Code being compiled. The instructions grow in a malloc'd buffer, after room
+// for the code item's header, so their positions are the ones they will have
+// in the code item; the constants are kept in a list, newest first, so the
+// collector can see them.
+// depth tracks how many values the code has on the stack at the current
+// instruction, and maxDepth the most it ever has.
+typedef struct CodeBuilder {
+  int *ops;
+  int length;
+  int capacity;
+  Item *constants;
+  int constantCount;
+  int depth;
+  int maxDepth;
+} CodeBuilder;
+
+//prints compiler error message then ends the evaluation
+void compilerError(char *message) {
+  fprintf(context->output, "Compile error: %s\n", message);
+  abandon();
+}
+
+// appends one word to the instructions
+void emit(CodeBuilder *code, int word) {
+  if (code->length >= code->capacity) {
+    code->capacity = code->capacity ? 2 * code->capacity : 64;
+    code->ops = realloc(code->ops, code->capacity * sizeof(int));
+    if (code->ops == NULL)
+      compilerError("out of memory");
+  }
+  code->ops[code->length++] = word;
+}
+
+// records that the instructions just emitted change the stack depth by effect
+void adjust(CodeBuilder *code, int effect) {
+  code->depth += effect;
+  if (code->depth > code->maxDepth)
+    code->maxDepth = code->depth;
+}
+
+// emits a jump-style instruction and returns the position of its target,
+// to be filled in by patch
+int emitJump(CodeBuilder *code, opcode op) {
+  emit(code, op);
+  emit(code, 0);
+  return code->length - 1;
+}
+
+// points the jump whose target is at position at the next instruction
+void patch(CodeBuilder *code, int position) {
+  code->ops[position] = code->length;
+}
+
+// adds item to the constants and returns its index
+int addConstant(CodeBuilder *code, Item *item) {
+  code->constants = cons(item, code->constants);
+  return code->constantCount++;
+}
+
+void emitConstant(CodeBuilder *code, Item *item) {
+  emit(code, OP_CONST);
+  emit(code, addConstant(code, item));
+  adjust(code, 1);
+}
+
+// in tail position, the value just pushed is the value of the whole code
+void emitReturn(CodeBuilder *code, bool tail) {
+  if (tail)
+    emit(code, OP_RETURN);
+}
+
+// emits an instruction that takes a lexical address or a global symbol
+void emitVariable(CodeBuilder *code, Item *var, opcode local, opcode global) {
+  if (typeOf(var) == LOCAL_TYPE) {
+    emit(code, local);
+    emit(code, var->la.depth);
+    emit(code, var->la.slot);
+  } else {
+    emit(code, global);
+    emit(code, addConstant(code, var));
+  }
+}
+
+void compileExpr(CodeBuilder *code, Item *expr, bool tail);
+
+// compiles a body: every expression but the last for effect, and the last
+// for its value
+void compileBody(CodeBuilder *code, Item *body, bool tail) {
+  while (typeOf(cdr(body)) == CONS_TYPE) {
+    compileExpr(code, car(body), false);
+    emit(code, OP_POP);
+    adjust(code, -1);
+    body = cdr(body);
+  }
+  compileExpr(code, car(body), tail);
+}
+
+// compiles and or or. Every operand but the last is tested with jumpOp, which
+// leaves a deciding value on the stack and jumps to the end.
+void compileAndOr(CodeBuilder *code, Item *args, bool tail, opcode jumpOp, bool empty) {
+  if (typeOf(args) != CONS_TYPE) {
+    emitConstant(code, makeBool(empty));
+    emitReturn(code, tail);
+    return;
+  }
+  Item *jumps = makeNull();
+  while (typeOf(cdr(args)) == CONS_TYPE) {
+    compileExpr(code, car(args), false);
+    jumps = cons(makeInt(emitJump(code, jumpOp)), jumps);
+    adjust(code, -1);
+    args = cdr(args);
+  }
+  compileExpr(code, car(args), tail);
+  for (; typeOf(jumps) == CONS_TYPE; jumps = cdr(jumps))
+    patch(code, intValue(car(jumps)));
+  emitReturn(code, tail);
+}
+
+// compiles the clauses of a cond, analysed into a list of (test . body)
+void compileCond(CodeBuilder *code, Item *clauses, bool tail) {
+  Item *ends = makeNull();
+  for (; typeOf(clauses) == CONS_TYPE; clauses = cdr(clauses)) {
+    Item *clause = car(clauses);
+    compileExpr(code, car(clause), false);
+    if (isNull(cdr(clause))) {
+      // a clause with no body gives the value of its test
+      ends = cons(makeInt(emitJump(code, OP_OR_JUMP)), ends);
+      adjust(code, -1);
+      continue;
+    }
+    int next = emitJump(code, OP_JUMP_IF_FALSE);
+    adjust(code, -1);
+    compileBody(code, cdr(clause), tail);
+    adjust(code, -1);
+    if (!tail)
+      ends = cons(makeInt(emitJump(code, OP_JUMP)), ends);
+    patch(code, next);
+  }
+  emit(code, OP_VOID);
+  adjust(code, 1);
+  for (; typeOf(ends) == CONS_TYPE; ends = cdr(ends))
+    patch(code, intValue(car(ends)));
+  emitReturn(code, tail);
+}
+
+// compiles a let, let* or letrec, analysed into (frameSize exprs . body)
+void compileLet(CodeBuilder *code, formKind kind, Item *args, bool tail) {
+  int size = intValue(car(args));
+  Item *exprs = car(cdr(args));
+  int count = length(exprs);
+  if (kind == LET_FORM) {
+    for (; typeOf(exprs) == CONS_TYPE; exprs = cdr(exprs))
+      compileExpr(code, car(exprs), false);
+    emit(code, OP_ENTER_FRAME);
+    emit(code, size);
+    emit(code, count);
+    adjust(code, -count);
+  } else {
+    emit(code, OP_ENTER_FRAME);
+    emit(code, size);
+    emit(code, 0);
+    for (int slot = 0; typeOf(exprs) == CONS_TYPE; slot++, exprs = cdr(exprs)) {
+      compileExpr(code, car(exprs), false);
+      if (kind == LETSTAR_FORM) {
+        emit(code, OP_STORE_LOCAL);
+        emit(code, 0);
+        emit(code, slot);
+        adjust(code, -1);
+      }
+    }
+    if (kind == LETREC_FORM) {
+      emit(code, OP_FILL);
+      emit(code, count);
+      adjust(code, -count);
+    }
+  }
+  compileBody(code, cdr(cdr(args)), tail);
+  if (!tail)
+    emit(code, OP_LEAVE_FRAME);
+}
+
+// turns a finished builder into a code item
+Item *finishCode(CodeBuilder *code, int frameSize) {
+  Item *result = makeItem(CODE_TYPE);
+  result->cd.frameSize = frameSize;
+  result->cd.maxStack = code->maxDepth;
+  result->cd.ops = talloc(code->length * sizeof(int));
+  result->cd.ops[0] = code->length;
+  result->cd.ops[1] = code->constantCount;
+  memcpy(result->cd.ops + CODE_HEADER, code->ops + CODE_HEADER, (code->length - CODE_HEADER) * sizeof(int));
+  free(code->ops);
+  code->ops = NULL;
+  result->cd.constants = tallocObject(code->constantCount * sizeof(Item *), POINTERS_OBJECT);
+  int index = code->constantCount;
+  for (Item *constant = code->constants; typeOf(constant) == CONS_TYPE; constant = cdr(constant))
+    result->cd.constants[--index] = car(constant);
+  return result;
+}
+
+// compiles a lambda, analysed into (params frameSize . body), to a code item
+// whose first constant is the parameter list
+Item *compileLambda(Item *args) {
+  CodeBuilder code = {NULL, CODE_HEADER, 0, makeNull(), 0, 0, 0};
+  addConstant(&code, car(args));
+  compileBody(&code, cdr(cdr(args)), true);
+  return finishCode(&code, intValue(car(cdr(args))));
+}
+
+// compiles a syntax node
+void compileForm(CodeBuilder *code, Item *expr, bool tail) {
+  Item *args = expr->sx.args;
+  switch (expr->sx.kind) {
+  case IF_FORM: {
+    compileExpr(code, car(args), false);
+    int otherwise = emitJump(code, OP_TEST_IF);
+    adjust(code, -1);
+    compileExpr(code, car(cdr(args)), tail);
+    adjust(code, -1);
+    int end = tail ? -1 : emitJump(code, OP_JUMP);
+    patch(code, otherwise);
+    compileExpr(code, car(cdr(cdr(args))), tail);
+    if (end >= 0)
+      patch(code, end);
+    return;
+  }
+  case COND_FORM:
+    compileCond(code, args, tail);
+    return;
+  case LET_FORM:
+  case LETSTAR_FORM:
+  case LETREC_FORM:
+    compileLet(code, expr->sx.kind, args, tail);
+    return;
+  case SETBANG_FORM:
+  case DEFINE_FORM:
+    compileExpr(code, car(cdr(args)), false);
+    emitVariable(code, car(args), OP_SET_LOCAL,
+                 expr->sx.kind == SETBANG_FORM ? OP_SET_GLOBAL : OP_DEFINE_GLOBAL);
+    emitReturn(code, tail);
+    return;
+  case SETCAR_FORM:
+  case SETCDR_FORM:
+    compileExpr(code, car(args), false);
+    compileExpr(code, car(cdr(args)), false);
+    emit(code, expr->sx.kind == SETCAR_FORM ? OP_SET_CAR : OP_SET_CDR);
+    adjust(code, -1);
+    emitReturn(code, tail);
+    return;
+  case AND_FORM:
+    compileAndOr(code, args, tail, OP_AND_JUMP, true);
+    return;
+  case OR_FORM:
+    compileAndOr(code, args, tail, OP_OR_JUMP, false);
+    return;
+  case LAMBDA_FORM:
+    emit(code, OP_CLOSURE);
+    emit(code, addConstant(code, compileLambda(args)));
+    adjust(code, 1);
+    emitReturn(code, tail);
+    return;
+  case QUOTE_FORM:
+    emitConstant(code, args);
+    emitReturn(code, tail);
+    return;
+  case APPLY_FORM: {
+    int argc = -1;
+    for (; typeOf(args) == CONS_TYPE; args = cdr(args), argc++)
+      compileExpr(code, car(args), false);
+    emit(code, tail ? OP_TAIL_CALL : OP_CALL);
+    emit(code, argc);
+    adjust(code, -argc);
+    return;
+  }
+  }
+}
+
+// compiles an analysed expression, leaving its value on the stack, or in
+// tail position returning it
+void compileExpr(CodeBuilder *code, Item *expr, bool tail) {
+  switch (typeOf(expr)) {
+  case INT_TYPE:
+  case BIGNUM_TYPE:
+  case DOUBLE_TYPE:
+  case VECTOR_TYPE:
+  case STR_TYPE:
+  case BOOL_TYPE:
+  case CLOSURE_TYPE:
+  case PRIMITIVE_TYPE:
+    emitConstant(code, expr);
+    break;
+  case LOCAL_TYPE:
+    if (expr->la.depth == 0) {
+      emit(code, OP_LOCAL0);
+      emit(code, expr->la.slot);
+    } else {
+      emit(code, OP_LOCAL);
+      emit(code, expr->la.depth);
+      emit(code, expr->la.slot);
+    }
+    adjust(code, 1);
+    break;
+  case SYMBOL_TYPE:
+    // the value is cached in a (value . version) pair, which starts with a
+    // version that never matches
+    emit(code, OP_GLOBAL);
+    emit(code, addConstant(code, expr));
+    emit(code, addConstant(code, cons(makeNull(), makeInt(-1))));
+    adjust(code, 1);
+    break;
+  case SYNTAX_TYPE:
+    compileForm(code, expr, tail);
+    return;
+  default: {
+    // evaluating anything else is an error, but only when it is reached
+    Item *message = makeItem(STR_TYPE);
+    message->s = "default";
+    emit(code, OP_FAIL);
+    emit(code, addConstant(code, message));
+    adjust(code, 1);
+    break;
+  }
+  }
+  emitReturn(code, tail);
+}
+
+Item *compile(Item *expr) {
+  CodeBuilder code = {NULL, CODE_HEADER, 0, makeNull(), 0, 0, 0};
+  compileExpr(&code, expr, true);
+  return finishCode(&code, 0);
+}
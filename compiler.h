@@ -0,0 +1,11 @@
+#include "item.h"
+
+#ifndef COMPILER_H
+#define COMPILER_H
+
+// Compiles an analysed top-level expression into a CODE_TYPE item that, run
+// by the VM in the global frame, evaluates it and returns its value. Lambdas
+// inside it are compiled to code items of their own, held as constants.
+Item *compile(Item *expr);
+
+#endif
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "item.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "tokenizer.h"
+#include "interpreter.h"
+#include "vm.h"
+#include "future.h"
+#include "image.h"
+#include "cache.h"
+#include "context.h"
+#include "scheme.h"
+
+_Thread_local Context *context = NULL;
+_Thread_local jmp_buf *escape = NULL;
+
+// the heap the calling thread had before it entered a context
+static _Thread_local Heap *outerHeap = NULL;
+
+Context *makeContext(bool useVM) {
+  Context *new = calloc(1, sizeof(Context));
+  if (new == NULL) {
+    printf("Allocation error: out of memory\n");
+    exit(1);
+  }
+  new->heap = theapCreate();
+  new->useVM = useVM;
+  new->output = stdout;
+  return new;
+}
+
+void freeContext(Context *old) {
+  stopPool(old);
+  closeCache(old->cache);
+  freeInput(old->input);
+  theapDestroy(old->heap);
+  freeImages(old->images);
+  free(old);
+}
+
+void enterContext(Context *new, void *stackBottom) {
+  context = new;
+  outerHeap = tuse(new->heap);
+  tinit(stackBottom);
+  stacks = &new->stacks;
+}
+
+void leaveContext() {
+  tdetach();
+  tuse(outerHeap);
+  context = NULL;
+  stacks = NULL;
+}
+
+// Each top-level datum is evaluated as soon as it has been read, and its
+// result written out before the next one is read. A file's analysed
+// expressions are taken from its cache when it has a current one.
+void evaluateInput() {
+  context->cache = openCache();
+  Item *tree;
+  while ((tree = nextTree(context->cache)) != NULL) {
+    if (context->useVM)
+      vmInterpret(tree);
+    else
+      interpret(tree);
+    fflush(context->output);
+  }
+  closeCache(context->cache);
+  context->cache = NULL;
+}
+
+void abandon() {
+  if (escape != NULL)
+    longjmp(*escape, 1);
+  texit(1);
+}
+
+SchemeContext *schemeCreate(bool useVM) {
+  Context *new = makeContext(useVM);
+  new->output = open_memstream(&new->outputBuffer, &new->outputSize);
+  if (new->output == NULL) {
+    printf("Allocation error: out of memory\n");
+    exit(1);
+  }
+  return new;
+}
+
+// evaluates the program in a string
+static void evaluateString(const char *source) {
+  openString(source);
+  evaluateInput();
+}
+
+// evaluates the program in the file at path
+static void evaluateFile(const char *path) {
+  openInput(path);
+  evaluateInput();
+}
+
+// runs action on argument in the target context, for the functions below,
+// returning 1 if an error stopped it and capturing what it wrote
+static int evaluate(Context *target, void (*action)(const char *), const char *argument, char **output) {
+  jmp_buf *outer = escape;
+  jmp_buf handler;
+  volatile int status = 0;
+  enterContext(target, &outer);
+  escape = &handler;
+  if (setjmp(handler) == 0) {
+    action(argument);
+  } else {
+    status = 1;
+  }
+  escape = outer;
+  closeCache(target->cache);
+  target->cache = NULL;
+  closeInput();
+  target->stacks.stackTop = 0;
+  target->stacks.callTop = 0;
+
+  // futures may still be writing to the stream, so it is held while what has
+  // been written so far is taken out and the stream emptied
+  flockfile(target->output);
+  fflush(target->output);
+  if (output != NULL) {
+    *output = malloc(target->outputSize + 1);
+    if (*output != NULL) {
+      memcpy(*output, target->outputBuffer, target->outputSize);
+      (*output)[target->outputSize] = '\0';
+    }
+  }
+  rewind(target->output);
+  funlockfile(target->output);
+
+  leaveContext();
+  return status;
+}
+
+int schemeEval(SchemeContext *target, const char *source, char **output) {
+  return evaluate(target, evaluateString, source, output);
+}
+
+int schemeLoad(SchemeContext *target, const char *path, char **output) {
+  return evaluate(target, evaluateFile, path, output);
+}
+
+int schemeSaveImage(SchemeContext *target, const char *path, char **output) {
+  return evaluate(target, saveImage, path, output);
+}
+
+int schemeLoadImage(SchemeContext *target, const char *path, char **output) {
+  return evaluate(target, loadImage, path, output);
+}
+
+// Everything there is now is sealed, so the collections that follow, the
+// ones in schemeRestore included, only look at what is allocated after.
+void schemeSave(SchemeContext *target) {
+  enterContext(target, &target);
+  saveGlobals();
+  tseal();
+  leaveContext();
+}
+
+// With the bindings made since put back, nothing an evaluation since
+// allocated is reachable unless it was stored into an object that was already
+// there, so a collection now reclaims all the rest in one go, and the next
+// evaluation starts with the collector's whole allowance. After schemeSave
+// that collection takes time for what was allocated since, not for the
+// prelude.
+void schemeRestore(SchemeContext *target) {
+  enterContext(target, &target);
+  restoreGlobals();
+  tcollect();
+  leaveContext();
+}
+
+void schemeDestroy(SchemeContext *old) {
+  stopPool(old);
+  fclose(old->output);
+  free(old->outputBuffer);
+  freeContext(old);
+}
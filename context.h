@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <setjmp.h>
+#include "item.h"
+#include "talloc.h"
+#include "vm.h"
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+// An interpreter: a heap of its own, the global environment in it, and what
+// it is reading, running and writing. A context is used by one thread at a
+// time, apart from the workers running its futures, and shares nothing with
+// other contexts but the symbols, which are interned for the whole process.
+typedef struct Context {
+  Heap *heap;
+  // the top-level frame, a root of the heap, and the count of changes to
+  // its bindings that global caches check
+  Frame *globalFrame;
+  long globalVersion;
+  // the global bindings saveGlobals recorded, or NULL, and a table of the
+  // globals defined or set since, or NULL if none have been
+  Item *savedGlobals;
+  Item *changedGlobals;
+  // the program being read, NULL until some input is opened
+  struct Input *input;
+  // the cache of the input's analysed expressions, while it is being read
+  struct Cache *cache;
+  // the VM stacks of the thread using the context
+  VMStacks stacks;
+  // the images loaded, which stay mapped until the context is freed
+  struct Image *images;
+  // the workers running futures, NULL until the first future is made
+  struct Pool *pool;
+  // whether top-level expressions run on the VM rather than the tree walker
+  bool useVM;
+  // where results and error messages are written; for a context made
+  // through the embedding interface, a stream into outputBuffer
+  FILE *output;
+  char *outputBuffer;
+  size_t outputSize;
+} Context;
+
+// The context the calling thread is running in.
+extern _Thread_local Context *context;
+
+// Makes a context with an empty heap, writing to stdout, and frees one with
+// everything in it. A context being freed must not be in use by any thread.
+Context *makeContext(bool useVM);
+void freeContext(Context *old);
+
+// Makes new the calling thread's context: attaches the thread to its heap,
+// scanning its stack up to stackBottom, and runs the VM on the context's
+// stacks. leaveContext undoes this.
+void enterContext(Context *new, void *stackBottom);
+void leaveContext();
+
+// Reads, analyses and evaluates each top-level expression of the context's
+// input in turn, printing its result.
+void evaluateInput();
+
+// Where the calling thread goes when an error ends an evaluation, or NULL if
+// an error ends the process.
+extern _Thread_local jmp_buf *escape;
+
+// Ends the evaluation under way once an error has been reported: jumps to
+// escape, or exits if there is none.
+void abandon();
+
+#endif
@@ -0,0 +1,372 @@
+#include <pthread.h>
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "item.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "vm.h"
+#include "context.h"
+#include "future.h"
+
+enum { FUTURE_WAITING, FUTURE_RUNNING, FUTURE_DONE, FUTURE_FAILED };
+
+// A worker's queue of futures, a ring buffer outside the heap holding the
+// entries from top up to bottom. The worker pushes and pops at the bottom, so
+// it runs the newest work first while its data is still in cache; idle
+// workers steal from the top, taking the oldest and usually biggest pieces.
+typedef struct Deque {
+  pthread_mutex_t lock;
+  Item **futures;
+  size_t capacity;
+  size_t top;
+  size_t bottom;
+} Deque;
+
+typedef struct Worker {
+  pthread_t thread;
+  struct Pool *pool;
+  Deque deque;
+  VMStacks stacks;
+} Worker;
+
+// The workers running a context's futures, one for every core but the one
+// the thread using the context runs on.
+typedef struct Pool {
+  Context *context;
+  Worker *workers;
+  int workerCount;
+  // entries in all the deques, some of which may have been run by a touch
+  // already; idle workers sleep on workAvailable until there are some, or
+  // until the pool is stopping. The thread using the context hands out its
+  // futures to the workers in turn.
+  pthread_mutex_t lock;
+  pthread_cond_t workAvailable;
+  int queued;
+  int nextWorker;
+  bool stopping;
+  // a future's state and value change under futureLock, and futureDone is
+  // broadcast whenever one finishes
+  pthread_mutex_t futureLock;
+  pthread_cond_t futureDone;
+} Pool;
+
+// the worker the calling thread is, or NULL for the thread using the context
+static _Thread_local Worker *currentWorker = NULL;
+
+// where the next steal starts looking, so thieves spread over the victims
+static _Thread_local unsigned stealSeed = 0;
+
+// prints error message and exits; used where a lock is held, so the
+// evaluation cannot just be abandoned
+void poolError(char *message) {
+  printf("Allocation error: %s\n", message);
+  exit(1);
+}
+
+// keeps the futures in the deques alive; called by the collector while every
+// other thread is stopped, so none of the deques is being changed
+void markQueued(void *data) {
+  Pool *pool = data;
+  for (int i = 0; i < pool->workerCount; i++) {
+    Deque *deque = &pool->workers[i].deque;
+    for (size_t entry = deque->top; entry != deque->bottom; entry++)
+      tmark(deque->futures[entry & (deque->capacity - 1)]);
+  }
+}
+
+void push(Item *future) {
+  Pool *pool = context->pool;
+  Worker *worker = currentWorker;
+  if (worker == NULL) {
+    pthread_mutex_lock(&pool->lock);
+    worker = &pool->workers[pool->nextWorker];
+    pool->nextWorker = (pool->nextWorker + 1) % pool->workerCount;
+    pthread_mutex_unlock(&pool->lock);
+  }
+  Deque *deque = &worker->deque;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom - deque->top == deque->capacity) {
+    Item **grown = malloc(2 * deque->capacity * sizeof(Item *));
+    if (grown == NULL)
+      poolError("out of memory");
+    for (size_t i = 0; i < deque->capacity; i++)
+      grown[i] = deque->futures[(deque->top + i) & (deque->capacity - 1)];
+    free(deque->futures);
+    deque->futures = grown;
+    deque->top = 0;
+    deque->bottom = deque->capacity;
+    deque->capacity *= 2;
+  }
+  deque->futures[deque->bottom++ & (deque->capacity - 1)] = future;
+  pthread_mutex_unlock(&deque->lock);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->queued++;
+  pthread_cond_signal(&pool->workAvailable);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+// removes and returns the newest future in the deque, or NULL if it is empty
+Item *popBottom(Deque *deque) {
+  Item *future = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom != deque->top)
+    future = deque->futures[--deque->bottom & (deque->capacity - 1)];
+  pthread_mutex_unlock(&deque->lock);
+  return future;
+}
+
+// removes and returns the oldest future in the deque, or NULL if it is empty
+Item *stealTop(Deque *deque) {
+  Item *future = NULL;
+  pthread_mutex_lock(&deque->lock);
+  if (deque->bottom != deque->top)
+    future = deque->futures[deque->top++ & (deque->capacity - 1)];
+  pthread_mutex_unlock(&deque->lock);
+  return future;
+}
+
+// returns a future from the calling worker's own deque, or else one stolen
+// from another's, or NULL if there are none anywhere
+Item *takeWork() {
+  Pool *pool = context->pool;
+  Item *future = NULL;
+  if (currentWorker != NULL)
+    future = popBottom(&currentWorker->deque);
+  stealSeed = stealSeed * 1103515245 + 12345;
+  int start = (stealSeed >> 16) % pool->workerCount;
+  for (int i = 0; future == NULL && i < pool->workerCount; i++) {
+    Worker *victim = &pool->workers[(start + i) % pool->workerCount];
+    if (victim != currentWorker)
+      future = stealTop(&victim->deque);
+  }
+  if (future != NULL) {
+    pthread_mutex_lock(&pool->lock);
+    pool->queued--;
+    pthread_mutex_unlock(&pool->lock);
+  }
+  return future;
+}
+
+// marks the future as running if nothing has started it yet, and returns
+// whether it did
+bool claim(Item *future) {
+  Pool *pool = context->pool;
+  pthread_mutex_lock(&pool->futureLock);
+  bool waiting = future->fu.state == FUTURE_WAITING;
+  if (waiting)
+    future->fu.state = FUTURE_RUNNING;
+  pthread_mutex_unlock(&pool->futureLock);
+  return waiting;
+}
+
+// records how a future ended, waking anything waiting for it
+void finish(Item *future, Item *value, int state) {
+  Pool *pool = context->pool;
+  pthread_mutex_lock(&pool->futureLock);
+  future->fu.value = value;
+  future->fu.function = NULL;
+  future->fu.state = state;
+  pthread_cond_broadcast(&pool->futureDone);
+  pthread_mutex_unlock(&pool->futureLock);
+}
+
+// Runs a claimed future and returns its value. If it raises an error, the
+// future is marked as failed before the error carries on unwinding.
+Item *runFuture(Item *future) {
+  jmp_buf handler;
+  jmp_buf *outer = escape;
+  int stackTop = stacks->stackTop;
+  int callTop = stacks->callTop;
+  escape = &handler;
+  if (setjmp(handler) != 0) {
+    escape = outer;
+    stacks->stackTop = stackTop;
+    stacks->callTop = callTop;
+    finish(future, NULL, FUTURE_FAILED);
+    abandon();
+  }
+  Item *argument = future->fu.value;
+  Item *value = argument == NULL
+    ? apply(future->fu.function, 0, NULL)
+    : apply(future->fu.function, 1, &argument);
+  escape = outer;
+  finish(future, value, FUTURE_DONE);
+  return value;
+}
+
+void *workerMain(void *argument) {
+  Worker *worker = argument;
+  Pool *pool = worker->pool;
+  currentWorker = worker;
+  stealSeed = (unsigned)(worker - pool->workers);
+  enterContext(pool->context, &argument);
+  stacks = &worker->stacks;
+
+  // an error in a future ends only that future
+  jmp_buf handler;
+  escape = &handler;
+  setjmp(handler);
+
+  while (true) {
+    Item *future = takeWork();
+    if (future != NULL) {
+      if (claim(future))
+        runFuture(future);
+      continue;
+    }
+    tpark();
+    pthread_mutex_lock(&pool->lock);
+    while (pool->queued == 0 && !pool->stopping)
+      pthread_cond_wait(&pool->workAvailable, &pool->lock);
+    bool stopping = pool->queued == 0;
+    pthread_mutex_unlock(&pool->lock);
+    tunpark();
+    if (stopping)
+      break;
+  }
+  escape = NULL;
+  leaveContext();
+  return NULL;
+}
+
+// starts the context's workers, each with as much stack as the main thread
+// gets, since evaluation recurses deeply
+void startPool() {
+  Pool *pool = calloc(1, sizeof(Pool));
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int count = cores > 1 ? (int)cores - 1 : 1;
+  if (pool == NULL || (pool->workers = calloc(count, sizeof(Worker))) == NULL)
+    poolError("out of memory");
+  pool->context = context;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->workAvailable, NULL);
+  pthread_mutex_init(&pool->futureLock, NULL);
+  pthread_cond_init(&pool->futureDone, NULL);
+  for (int i = 0; i < count; i++) {
+    Worker *worker = &pool->workers[i];
+    worker->pool = pool;
+    pthread_mutex_init(&worker->deque.lock, NULL);
+    worker->deque.capacity = 64;
+    worker->deque.futures = malloc(worker->deque.capacity * sizeof(Item *));
+    if (worker->deque.futures == NULL)
+      poolError("out of memory");
+  }
+  pool->workerCount = count;
+  context->pool = pool;
+  tmarker(markQueued, pool);
+
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  struct rlimit limit;
+  if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    pthread_attr_setstacksize(&attributes, limit.rlim_cur);
+  for (int i = 0; i < count; i++)
+    if (pthread_create(&pool->workers[i].thread, &attributes, workerMain, &pool->workers[i]) != 0)
+      poolError("could not start a worker thread");
+  pthread_attr_destroy(&attributes);
+}
+
+void stopPool(Context *owner) {
+  Pool *pool = owner->pool;
+  if (pool == NULL)
+    return;
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = true;
+  pthread_cond_broadcast(&pool->workAvailable);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->workerCount; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+    pthread_mutex_destroy(&pool->workers[i].deque.lock);
+    free(pool->workers[i].deque.futures);
+  }
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->workAvailable);
+  pthread_mutex_destroy(&pool->futureLock);
+  pthread_cond_destroy(&pool->futureDone);
+  free(pool->workers);
+  free(pool);
+  owner->pool = NULL;
+}
+
+Item *makeFuture(Item *function, Item *argument) {
+  if (context->pool == NULL)
+    startPool();
+  Item *future = makeItem(FUTURE_TYPE);
+  future->fu.function = function;
+  future->fu.value = argument;
+  future->fu.state = FUTURE_WAITING;
+  push(future);
+  return future;
+}
+
+Item *touch(Item *future) {
+  if (typeOf(future) != FUTURE_TYPE)
+    return future;
+  Pool *pool = context->pool;
+  while (true) {
+    pthread_mutex_lock(&pool->futureLock);
+    int state = future->fu.state;
+    Item *value = future->fu.value;
+    if (state == FUTURE_WAITING)
+      future->fu.state = FUTURE_RUNNING;
+    pthread_mutex_unlock(&pool->futureLock);
+    if (state == FUTURE_DONE)
+      return value;
+    if (state == FUTURE_FAILED)
+      evaluationError("touched a future that raised an error");
+    if (state == FUTURE_WAITING)
+      return runFuture(future);
+
+    // another thread is running it: help with other work meanwhile, and
+    // block only once there is none
+    Item *other = takeWork();
+    if (other != NULL) {
+      if (claim(other))
+        runFuture(other);
+      continue;
+    }
+    tpark();
+    pthread_mutex_lock(&pool->futureLock);
+    while (future->fu.state == FUTURE_RUNNING)
+      pthread_cond_wait(&pool->futureDone, &pool->futureLock);
+    pthread_mutex_unlock(&pool->futureLock);
+    tunpark();
+  }
+}
+
+// returns argument, checking it is a procedure
+Item *procedureArgument(Item *argument, char *message) {
+  if (typeOf(argument) != CLOSURE_TYPE && typeOf(argument) != PRIMITIVE_TYPE)
+    evaluationError(message);
+  return argument;
+}
+
+Item *primitiveFuture(int argc, Item **argv) {
+  return makeFuture(procedureArgument(argv[0], "future requires a procedure"), NULL);
+}
+
+Item *primitiveTouch(int argc, Item **argv) {
+  return touch(argv[0]);
+}
+
+// Starts a future for each element, then touches them from the last back to
+// the first, so this thread works from the end of the list while the workers
+// take from the front, and the results come out in order.
+Item *primitivePmap(int argc, Item **argv) {
+  Item *function = procedureArgument(argv[0], "pmap requires a procedure as first argument");
+  Item *list = argv[1];
+  Item *futures = makeNull();
+  for (; typeOf(list) == CONS_TYPE; list = cdr(list))
+    futures = cons(makeFuture(function, car(list)), futures);
+  if (typeOf(list) != NULL_TYPE)
+    evaluationError("pmap requires a proper list");
+  Item *results = makeNull();
+  for (; typeOf(futures) == CONS_TYPE; futures = cdr(futures))
+    results = cons(touch(car(futures)), results);
+  return results;
+}
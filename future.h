@@ -0,0 +1,24 @@
+#include "item.h"
+#include "context.h"
+
+#ifndef FUTURE_H
+#define FUTURE_H
+
+// Makes a future that calls function with argument, or with no arguments if
+// argument is NULL, on the worker pool. The pool is started the first time.
+Item *makeFuture(Item *function, Item *argument);
+
+// Returns the value of a future, running it here if no worker has started it
+// yet, and the item itself if it is not a future.
+Item *touch(Item *future);
+
+// Stops the workers running the context's futures, once they have run out of
+// work, and frees them. Does nothing if it has never made a future.
+void stopPool(Context *owner);
+
+// The future primitives, bound by globalEnvironment.
+Item *primitiveFuture(int argc, Item **argv);
+Item *primitiveTouch(int argc, Item **argv);
+Item *primitivePmap(int argc, Item **argv);
+
+#endif
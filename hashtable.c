@@ -0,0 +1,389 @@
+#include <stdint.h>
+#include <string.h>
+#include "item.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "bignum.h"
+#include "hashtable.h"
+
+// A key slot that held an entry since deleted. Probing goes on past it, and
+// an insertion may reuse it. It is an immediate nothing else ever produces.
+#define DELETED_KEY IMMEDIATE(VOID_TYPE, 1)
+
+// the number of key and value pairs a new table has room for
+#define INITIAL_CAPACITY 8
+
+// how many parts of a structure equal-hashing looks at before it stops, so
+// that big or circular structures hash in bounded time
+#define HASH_BUDGET 64
+
+bool isEqv(Item *a, Item *b) {
+  if (a == b)
+    return true;
+  if (typeOf(a) != typeOf(b))
+    return false;
+  if (typeOf(a) == DOUBLE_TYPE)
+    return memcmp(&a->d, &b->d, sizeof(double)) == 0;
+  if (typeOf(a) == BIGNUM_TYPE)
+    return integerCompare(a, b) == 0;
+  return false;
+}
+
+bool isEqual(Item *a, Item *b) {
+  for (;;) {
+    if (isEqv(a, b))
+      return true;
+    if (typeOf(a) != typeOf(b))
+      return false;
+    switch (typeOf(a)) {
+    case STR_TYPE:
+      return strcmp(a->s, b->s) == 0;
+    case VECTOR_TYPE:
+      if (a->vec.length != b->vec.length)
+        return false;
+      for (int i = 0; i < a->vec.length; i++)
+        if (!isEqual(a->vec.elements[i], b->vec.elements[i]))
+          return false;
+      return true;
+    case CONS_TYPE:
+      if (!isEqual(car(a), car(b)))
+        return false;
+      a = cdr(a);
+      b = cdr(b);
+      continue;
+    default:
+      return false;
+    }
+  }
+}
+
+// scrambles the bits of a word so that keys differing only a little, such as
+// neighbouring addresses, spread over the whole table
+static uint64_t mix(uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  return x;
+}
+
+static uint64_t hashString(char *s) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (; *s; s++)
+    hash = (hash ^ (unsigned char)*s) * 1099511628211ULL;
+  return hash;
+}
+
+static uint64_t hashEqv(Item *key) {
+  if (typeOf(key) == DOUBLE_TYPE) {
+    uint64_t bits;
+    memcpy(&bits, &key->d, sizeof(bits));
+    return mix(bits);
+  }
+  if (typeOf(key) == BIGNUM_TYPE) {
+    uint64_t hash = key->bn.negative;
+    for (int i = 0; i < key->bn.length; i++)
+      hash = mix(hash ^ key->bn.digits[i]);
+    return hash;
+  }
+  return mix((uintptr_t)key);
+}
+
+static uint64_t hashEqual(Item *key, int *budget) {
+  if (--*budget < 0)
+    return 0;
+  switch (typeOf(key)) {
+  case STR_TYPE:
+    return hashString(key->s);
+  case CONS_TYPE:
+    return mix(hashEqual(car(key), budget) * 31 + hashEqual(cdr(key), budget));
+  case VECTOR_TYPE: {
+    uint64_t hash = key->vec.length;
+    for (int i = 0; i < key->vec.length && *budget > 0; i++)
+      hash = mix(hash * 31 + hashEqual(key->vec.elements[i], budget));
+    return hash;
+  }
+  default:
+    return hashEqv(key);
+  }
+}
+
+static uint64_t hashKey(Item *table, Item *key) {
+  switch (table->ht.equivalence) {
+  case EQ_EQUIVALENCE:
+    return mix((uintptr_t)key);
+  case EQV_EQUIVALENCE:
+    return hashEqv(key);
+  case STRING_EQUIVALENCE:
+    if (typeOf(key) != STR_TYPE)
+      evaluationError("hash table keys must be strings");
+    return hashString(key->s);
+  default: {
+    int budget = HASH_BUDGET;
+    return hashEqual(key, &budget);
+  }
+  }
+}
+
+static bool sameKey(Item *table, Item *a, Item *b) {
+  switch (table->ht.equivalence) {
+  case EQ_EQUIVALENCE:
+    return a == b;
+  case EQV_EQUIVALENCE:
+    return isEqv(a, b);
+  case STRING_EQUIVALENCE:
+    return strcmp(a->s, b->s) == 0;
+  default:
+    return isEqual(a, b);
+  }
+}
+
+// Returns the index of the pair holding key, or if it is not there the index
+// of the pair an insertion of it should use, and sets found accordingly.
+// Probing is linear, and stops at the first pair never used.
+static int findSlot(Item *table, Item *key, bool *found) {
+  Item **slots = table->ht.slots;
+  int mask = table->ht.capacity - 1;
+  int index = hashKey(table, key) & mask;
+  int reusable = -1;
+  for (;; index = (index + 1) & mask) {
+    Item *slotKey = slots[2 * index];
+    if (slotKey == NULL) {
+      *found = false;
+      return reusable >= 0 ? reusable : index;
+    }
+    if (slotKey == DELETED_KEY) {
+      if (reusable < 0)
+        reusable = index;
+    } else if (sameKey(table, slotKey, key)) {
+      *found = true;
+      return index;
+    }
+  }
+}
+
+// moves the entries into a new array of pairs, big enough that the table is
+// at most half full, dropping deleted slots
+static void resize(Item *table) {
+  int capacity = INITIAL_CAPACITY;
+  while (2 * (table->ht.count + 1) > capacity)
+    capacity *= 2;
+  Item **old = table->ht.slots;
+  int oldCapacity = table->ht.capacity;
+  table->ht.slots = tallocObject(2 * capacity * sizeof(Item *), POINTERS_OBJECT);
+  memset(table->ht.slots, 0, 2 * capacity * sizeof(Item *));
+  table->ht.capacity = capacity;
+  table->ht.used = table->ht.count;
+  for (int i = 0; i < oldCapacity; i++) {
+    Item *key = old[2 * i];
+    if (key == NULL || key == DELETED_KEY)
+      continue;
+    bool found;
+    int index = findSlot(table, key, &found);
+    table->ht.slots[2 * index] = key;
+    table->ht.slots[2 * index + 1] = old[2 * i + 1];
+  }
+}
+
+Item *makeHashTable(equivalence kind) {
+  Item *table = makeItem(HASHTABLE_TYPE);
+  table->ht.equivalence = kind;
+  table->ht.capacity = INITIAL_CAPACITY;
+  table->ht.slots = tallocObject(2 * INITIAL_CAPACITY * sizeof(Item *), POINTERS_OBJECT);
+  memset(table->ht.slots, 0, 2 * INITIAL_CAPACITY * sizeof(Item *));
+  return table;
+}
+
+Item *hashTableGet(Item *table, Item *key) {
+  bool found;
+  int index = findSlot(table, key, &found);
+  return found ? table->ht.slots[2 * index + 1] : NULL;
+}
+
+void hashTableSet(Item *table, Item *key, Item *value) {
+  bool found;
+  int index = findSlot(table, key, &found);
+  if (found) {
+    table->ht.slots[2 * index + 1] = value;
+    return;
+  }
+  // keep at least a quarter of the pairs never used, so probes stay short
+  // and always end
+  if (4 * (table->ht.used + 1) > 3 * table->ht.capacity) {
+    resize(table);
+    index = findSlot(table, key, &found);
+  }
+  if (table->ht.slots[2 * index] == NULL)
+    table->ht.used++;
+  table->ht.slots[2 * index] = key;
+  table->ht.slots[2 * index + 1] = value;
+  table->ht.count++;
+}
+
+void hashTableDelete(Item *table, Item *key) {
+  bool found;
+  int index = findSlot(table, key, &found);
+  if (!found)
+    return;
+  table->ht.slots[2 * index] = DELETED_KEY;
+  table->ht.slots[2 * index + 1] = NULL;
+  table->ht.count--;
+}
+
+void hashTableRehash(Item *table) {
+  resize(table);
+}
+
+void hashTableEach(Item *table, void (*visit)(Item *key, Item *value, void *data), void *data) {
+  for (int i = 0; i < table->ht.capacity; i++) {
+    Item *key = table->ht.slots[2 * i];
+    if (key != NULL && key != DELETED_KEY)
+      visit(key, table->ht.slots[2 * i + 1], data);
+  }
+}
+
+// primitives
+
+// returns true if every neighbouring pair of the argc items at argv is related
+// by same
+static Item *relateAll(int argc, Item **argv, bool (*same)(Item *, Item *)) {
+  for (int i = 1; i < argc; i++)
+    if (!same(argv[i - 1], argv[i]))
+      return FALSE_ITEM;
+  return TRUE_ITEM;
+}
+
+static bool isEq(Item *a, Item *b) {
+  return a == b;
+}
+
+static bool isSameString(Item *a, Item *b) {
+  if (typeOf(a) != STR_TYPE || typeOf(b) != STR_TYPE)
+    evaluationError("string=? requires strings as arguments");
+  return strcmp(a->s, b->s) == 0;
+}
+
+Item *primitiveEq(int argc, Item **argv) {
+  return relateAll(argc, argv, isEq);
+}
+
+Item *primitiveEqv(int argc, Item **argv) {
+  return relateAll(argc, argv, isEqv);
+}
+
+Item *primitiveEqual(int argc, Item **argv) {
+  return relateAll(argc, argv, isEqual);
+}
+
+Item *primitiveStringEqual(int argc, Item **argv) {
+  if (argc == 1 && typeOf(argv[0]) != STR_TYPE)
+    evaluationError("string=? requires strings as arguments");
+  return relateAll(argc, argv, isSameString);
+}
+
+// returns argument, checking it is a hash table
+static Item *tableArgument(Item *argument, char *message) {
+  if (typeOf(argument) != HASHTABLE_TYPE)
+    evaluationError(message);
+  return argument;
+}
+
+static Item *callWith(Item *function, int argc, Item **argv) {
+  if (typeOf(function) != CLOSURE_TYPE && typeOf(function) != PRIMITIVE_TYPE)
+    evaluationError("hash table operation given something that is not a procedure");
+  return apply(function, argc, argv);
+}
+
+// (make-hash-table [equivalence [hash]]). The equivalence is one of eq?,
+// eqv?, equal? or string=?, and picks the matching built-in hash; a hash
+// function given as well is accepted but not needed.
+Item *primitiveMakeHashTable(int argc, Item **argv) {
+  if (argc == 0)
+    return makeHashTable(EQUAL_EQUIVALENCE);
+  Item *same = argv[0];
+  if (typeOf(same) == PRIMITIVE_TYPE) {
+    if (same->pf.function == primitiveEq)
+      return makeHashTable(EQ_EQUIVALENCE);
+    if (same->pf.function == primitiveEqv)
+      return makeHashTable(EQV_EQUIVALENCE);
+    if (same->pf.function == primitiveEqual)
+      return makeHashTable(EQUAL_EQUIVALENCE);
+    if (same->pf.function == primitiveStringEqual)
+      return makeHashTable(STRING_EQUIVALENCE);
+  }
+  evaluationError("make-hash-table supports only eq?, eqv?, equal? and string=?");
+  return makeNull();
+}
+
+// (hash-table-ref table key [thunk]) calls thunk if key is missing
+Item *primitiveHashTableRef(int argc, Item **argv) {
+  Item *table = tableArgument(argv[0], "hash-table-ref requires a hash table as first argument");
+  Item *value = hashTableGet(table, argv[1]);
+  if (value != NULL)
+    return value;
+  if (argc == 2)
+    evaluationError("hash-table-ref key not found");
+  return callWith(argv[2], 0, NULL);
+}
+
+Item *primitiveHashTableRefDefault(int argc, Item **argv) {
+  Item *table = tableArgument(argv[0], "hash-table-ref/default requires a hash table as first argument");
+  Item *value = hashTableGet(table, argv[1]);
+  return value != NULL ? value : argv[2];
+}
+
+Item *primitiveHashTableSet(int argc, Item **argv) {
+  Item *table = tableArgument(argv[0], "hash-table-set! requires a hash table as first argument");
+  hashTableSet(table, argv[1], argv[2]);
+  return VOID_ITEM;
+}
+
+Item *primitiveHashTableDelete(int argc, Item **argv) {
+  Item *table = tableArgument(argv[0], "hash-table-delete! requires a hash table as first argument");
+  hashTableDelete(table, argv[1]);
+  return VOID_ITEM;
+}
+
+Item *primitiveHashTableContains(int argc, Item **argv) {
+  Item *table = tableArgument(argv[0], "hash-table-contains? requires a hash table as first argument");
+  return makeBool(hashTableGet(table, argv[1]) != NULL);
+}
+
+// (hash-table-update! table key function [thunk]) stores the result of
+// calling function on the value under key, or on the result of thunk if key
+// is missing
+Item *primitiveHashTableUpdate(int argc, Item **argv) {
+  Item *table = tableArgument(argv[0], "hash-table-update! requires a hash table as first argument");
+  Item *key = argv[1];
+  Item *function = argv[2];
+  Item *value = hashTableGet(table, key);
+  if (value == NULL) {
+    if (argc == 3)
+      evaluationError("hash-table-update! key not found");
+    value = callWith(argv[3], 0, NULL);
+  }
+  value = callWith(function, 1, &value);
+  hashTableSet(table, key, value);
+  return VOID_ITEM;
+}
+
+Item *primitiveHashTableCount(int argc, Item **argv) {
+  return makeInt(tableArgument(argv[0], "hash-table-count requires a hash table")->ht.count);
+}
+
+// calls a function with each key and its value. If the function makes the
+// table grow, the walk carries on over the pairs as they were laid out before.
+Item *primitiveHashTableWalk(int argc, Item **argv) {
+  Item *table = tableArgument(argv[0], "hash-table-walk requires a hash table as first argument");
+  Item *function = argv[1];
+  Item **slots = table->ht.slots;
+  int capacity = table->ht.capacity;
+  for (int i = 0; i < capacity; i++) {
+    Item *key = slots[2 * i];
+    if (key == NULL || key == DELETED_KEY)
+      continue;
+    Item *pair[2] = {key, slots[2 * i + 1]};
+    callWith(function, 2, pair);
+  }
+  return VOID_ITEM;
+}
@@ -0,0 +1,50 @@
+#include <stdbool.h>
+#include "item.h"
+
+#ifndef HASHTABLE_H
+#define HASHTABLE_H
+
+// The equivalences a hash table can compare its keys by.
+typedef enum {
+  EQ_EQUIVALENCE, EQV_EQUIVALENCE, EQUAL_EQUIVALENCE, STRING_EQUIVALENCE
+} equivalence;
+
+// The eqv? and equal? relations.
+bool isEqv(Item *a, Item *b);
+bool isEqual(Item *a, Item *b);
+
+// Makes an empty hash table comparing keys by kind.
+Item *makeHashTable(equivalence kind);
+
+// Returns the value stored under key, or NULL if there is none.
+Item *hashTableGet(Item *table, Item *key);
+
+// Stores value under key, replacing any value already there.
+void hashTableSet(Item *table, Item *key, Item *value);
+
+// Removes key and its value, if it is there.
+void hashTableDelete(Item *table, Item *key);
+
+// Rehashes every key, as needed once keys compared by identity have moved.
+void hashTableRehash(Item *table);
+
+// Calls visit with each key, its value and data, in no particular order.
+// visit must not add keys to the table or remove them.
+void hashTableEach(Item *table, void (*visit)(Item *key, Item *value, void *data), void *data);
+
+// The equivalence and hash table primitives, bound by globalEnvironment.
+Item *primitiveEq(int argc, Item **argv);
+Item *primitiveEqv(int argc, Item **argv);
+Item *primitiveEqual(int argc, Item **argv);
+Item *primitiveStringEqual(int argc, Item **argv);
+Item *primitiveMakeHashTable(int argc, Item **argv);
+Item *primitiveHashTableRef(int argc, Item **argv);
+Item *primitiveHashTableRefDefault(int argc, Item **argv);
+Item *primitiveHashTableSet(int argc, Item **argv);
+Item *primitiveHashTableDelete(int argc, Item **argv);
+Item *primitiveHashTableContains(int argc, Item **argv);
+Item *primitiveHashTableUpdate(int argc, Item **argv);
+Item *primitiveHashTableCount(int argc, Item **argv);
+Item *primitiveHashTableWalk(int argc, Item **argv);
+
+#endif
@@ -0,0 +1,489 @@
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "item.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "symbols.h"
+#include "interpreter.h"
+#include "hashtable.h"
+#include "context.h"
+#include "image.h"
+
+// changes whenever the layout of items, frames or code changes
+#define IMAGE_VERSION 2
+
+// objects in an image start at multiples of this, as they do in the heap
+#define IMAGE_ALIGNMENT 16
+
+// What a word listed in the relocation table holds, in its low bits, above
+// which is the word's offset in the image.
+enum {
+  RELOCATE_POINTER,     // the offset of an object in the image
+  RELOCATE_SYMBOL,      // the offset of a symbol's name
+  RELOCATE_NAME,        // the offset of the name a primitive is known by
+  RELOCATE_PRIMITIVE,   // the offset of the name of a primitive's function
+  RELOCATE_GLOBAL_FRAME // nothing: the word points to the global frame
+};
+#define RELOCATION_BITS 3
+
+typedef struct ImageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t itemSize;
+  uint64_t size;
+  // the relocation table, and the offsets of hash tables, which need
+  // rehashing once the keys they compare by address have moved
+  uint64_t relocations;
+  uint64_t relocationCount;
+  uint64_t tables;
+  uint64_t tableCount;
+  // globalVersion when the image was made; every global cache in it was
+  // filled at that count or before
+  int64_t globalVersion;
+  // a list of (variable . value) pairs, one for each global binding
+  Item *bindings;
+} ImageHeader;
+
+static const char imageMagic[8] = "SCMIMAGE";
+
+// An image loaded into a context, which stays mapped as long as the context.
+typedef struct Image {
+  char *base;
+  size_t size;
+  struct Image *next;
+} Image;
+
+// what an object being written to an image is, for converting its pointers
+typedef enum {
+  COPY_ITEM, COPY_FRAME, COPY_POINTERS, COPY_RAW
+} copyKind;
+
+typedef struct Pending {
+  uint64_t offset;
+  copyKind kind;
+  size_t count;
+} Pending;
+
+// An image being written: its bytes so far, and the tables that go at the
+// end. Objects are copied in when first reached, and their pointers
+// converted to offsets when they come off the pending list.
+typedef struct Writer {
+  char *data;
+  size_t size;
+  size_t capacity;
+  uint64_t *relocations;
+  size_t relocationCount;
+  size_t relocationCapacity;
+  uint64_t *tables;
+  size_t tableCount;
+  size_t tableCapacity;
+  Pending *pending;
+  size_t pendingCount;
+  size_t pendingCapacity;
+  // open-addressed map from the address of each object copied to its offset
+  void **keys;
+  uint64_t *offsets;
+  size_t mapCount;
+  size_t mapCapacity;
+  const char *failure;
+} Writer;
+
+// prints error message and exits
+void imageAllocationError() {
+  printf("Allocation error: out of memory\n");
+  exit(1);
+}
+
+// makes room for count more elements of the given size in a growing array
+static void *reserve(void *array, size_t *capacity, size_t count, size_t size) {
+  if (count <= *capacity)
+    return array;
+  size_t grown = *capacity ? 2 * *capacity : 64;
+  while (grown < count)
+    grown *= 2;
+  array = realloc(array, grown * size);
+  if (array == NULL)
+    imageAllocationError();
+  *capacity = grown;
+  return array;
+}
+
+static size_t slotFor(Writer *writer, void *key) {
+  size_t slot = ((uintptr_t)key >> 4) * 0x9e3779b97f4a7c15ULL;
+  slot &= writer->mapCapacity - 1;
+  while (writer->keys[slot] != NULL && writer->keys[slot] != key)
+    slot = (slot + 1) & (writer->mapCapacity - 1);
+  return slot;
+}
+
+static void remember(Writer *writer, void *key, uint64_t offset) {
+  if (2 * (writer->mapCount + 1) > writer->mapCapacity) {
+    void **keys = writer->keys;
+    uint64_t *offsets = writer->offsets;
+    size_t capacity = writer->mapCapacity;
+    writer->mapCapacity = capacity ? 2 * capacity : 1024;
+    writer->keys = calloc(writer->mapCapacity, sizeof(void *));
+    writer->offsets = malloc(writer->mapCapacity * sizeof(uint64_t));
+    if (writer->keys == NULL || writer->offsets == NULL)
+      imageAllocationError();
+    for (size_t i = 0; i < capacity; i++) {
+      if (keys[i] != NULL) {
+        size_t slot = slotFor(writer, keys[i]);
+        writer->keys[slot] = keys[i];
+        writer->offsets[slot] = offsets[i];
+      }
+    }
+    free(keys);
+    free(offsets);
+  }
+  size_t slot = slotFor(writer, key);
+  writer->keys[slot] = key;
+  writer->offsets[slot] = offset;
+  writer->mapCount++;
+}
+
+// appends size bytes, aligned, and returns their offset
+static uint64_t append(Writer *writer, const void *bytes, size_t size) {
+  size_t offset = (writer->size + IMAGE_ALIGNMENT - 1) & ~(size_t)(IMAGE_ALIGNMENT - 1);
+  writer->data = reserve(writer->data, &writer->capacity, offset + size, 1);
+  memset(writer->data + writer->size, 0, offset - writer->size);
+  memcpy(writer->data + offset, bytes, size);
+  writer->size = offset + size;
+  return offset;
+}
+
+// returns the offset of the copy of object, copying it in the first time
+static uint64_t copyObject(Writer *writer, void *object, size_t size, copyKind kind, size_t count) {
+  if (writer->mapCapacity > 0) {
+    size_t slot = slotFor(writer, object);
+    if (writer->keys[slot] == object)
+      return writer->offsets[slot];
+  }
+  uint64_t offset = append(writer, object, size);
+  remember(writer, object, offset);
+  if (kind != COPY_RAW) {
+    writer->pending = reserve(writer->pending, &writer->pendingCapacity,
+                              writer->pendingCount + 1, sizeof(Pending));
+    writer->pending[writer->pendingCount++] = (Pending){offset, kind, count};
+  }
+  return offset;
+}
+
+// sets the word at offset to value, and lists it to be relocated as kind
+static void relocate(Writer *writer, uint64_t offset, uint64_t value, int kind) {
+  memcpy(writer->data + offset, &value, sizeof(value));
+  writer->relocations = reserve(writer->relocations, &writer->relocationCapacity,
+                                writer->relocationCount + 1, sizeof(uint64_t));
+  writer->relocations[writer->relocationCount++] = offset << RELOCATION_BITS | kind;
+}
+
+// returns the word at offset as a pointer
+static void *wordAt(Writer *writer, uint64_t offset) {
+  void *word;
+  memcpy(&word, writer->data + offset, sizeof(word));
+  return word;
+}
+
+static void convertRaw(Writer *writer, uint64_t offset, size_t size) {
+  void *object = wordAt(writer, offset);
+  if (object != NULL)
+    relocate(writer, offset, copyObject(writer, object, size, COPY_RAW, 0), RELOCATE_POINTER);
+}
+
+static void convertPointers(Writer *writer, uint64_t offset, size_t count) {
+  void *object = wordAt(writer, offset);
+  if (object != NULL)
+    relocate(writer, offset, copyObject(writer, object, count * sizeof(Item *), COPY_POINTERS, count),
+             RELOCATE_POINTER);
+}
+
+// converts the word at offset, which holds an item
+static void convertItem(Writer *writer, uint64_t offset) {
+  Item *item = wordAt(writer, offset);
+  if (item == NULL || !isHeapItem(item))
+    return;
+  if (item->type == SYMBOL_TYPE) {
+    size_t length = strlen(item->s) + 1;
+    relocate(writer, offset, copyObject(writer, item->s, length, COPY_RAW, 0), RELOCATE_SYMBOL);
+    return;
+  }
+  relocate(writer, offset, copyObject(writer, item, sizeof(Item), COPY_ITEM, 0), RELOCATE_POINTER);
+}
+
+// converts the word at offset, which points to a frame
+static void convertFrame(Writer *writer, uint64_t offset) {
+  Frame *frame = wordAt(writer, offset);
+  if (frame == NULL)
+    return;
+  if (frame == context->globalFrame) {
+    relocate(writer, offset, 0, RELOCATE_GLOBAL_FRAME);
+    return;
+  }
+  size_t size = sizeof(Frame) + frame->size * sizeof(Item *);
+  relocate(writer, offset, copyObject(writer, frame, size, COPY_FRAME, 0), RELOCATE_POINTER);
+}
+
+#define AT(field) (pending.offset + offsetof(Item, field))
+
+// converts the pointers in an item copied to the image
+static void convertFields(Writer *writer, Pending pending) {
+  Item item;
+  memcpy(&item, writer->data + pending.offset, sizeof(Item));
+  switch (item.type) {
+  case DOUBLE_TYPE:
+    break;
+  case CONS_TYPE:
+    convertItem(writer, AT(c.car));
+    convertItem(writer, AT(c.cdr));
+    break;
+  case STR_TYPE:
+    convertRaw(writer, AT(s), strlen(item.s) + 1);
+    break;
+  case CLOSURE_TYPE:
+    convertItem(writer, AT(cl.paramNames));
+    convertItem(writer, AT(cl.functionCode));
+    convertFrame(writer, AT(cl.frame));
+    break;
+  case PRIMITIVE_TYPE: {
+    uint64_t name = copyObject(writer, item.pf.name, strlen(item.pf.name) + 1, COPY_RAW, 0);
+    relocate(writer, AT(pf.function), name, RELOCATE_PRIMITIVE);
+    relocate(writer, AT(pf.name), name, RELOCATE_NAME);
+    break;
+  }
+  case SYNTAX_TYPE: {
+    // the cache is filled again on the first call
+    Item *empty = NULL;
+    memcpy(writer->data + AT(sx.cache), &empty, sizeof(empty));
+    convertItem(writer, AT(sx.args));
+    break;
+  }
+  case LOCAL_TYPE:
+    convertItem(writer, AT(la.name));
+    break;
+  case CODE_TYPE:
+    convertRaw(writer, AT(cd.ops), item.cd.ops[0] * sizeof(int));
+    convertPointers(writer, AT(cd.constants), item.cd.ops[1]);
+    break;
+  case BIGNUM_TYPE:
+    convertRaw(writer, AT(bn.digits), (item.bn.length > 0 ? item.bn.length : 1) * sizeof(uint32_t));
+    break;
+  case VECTOR_TYPE:
+    convertPointers(writer, AT(vec.elements), item.vec.length);
+    break;
+  case HASHTABLE_TYPE:
+    writer->tables = reserve(writer->tables, &writer->tableCapacity,
+                             writer->tableCount + 1, sizeof(uint64_t));
+    writer->tables[writer->tableCount++] = pending.offset;
+    convertPointers(writer, AT(ht.slots), 2 * item.ht.capacity);
+    break;
+  case FUTURE_TYPE:
+    writer->failure = "cannot save a future";
+    break;
+  default:
+    writer->failure = "cannot save an item of this type";
+    break;
+  }
+}
+
+#undef AT
+
+// converts the pointers in the object that came off the pending list
+static void convertPending(Writer *writer, Pending pending) {
+  if (pending.kind == COPY_ITEM) {
+    convertFields(writer, pending);
+  } else if (pending.kind == COPY_FRAME) {
+    Frame frame;
+    memcpy(&frame, writer->data + pending.offset, sizeof(Frame));
+    convertItem(writer, pending.offset + offsetof(Frame, bindings));
+    convertFrame(writer, pending.offset + offsetof(Frame, parent));
+    for (int i = 0; i < frame.size; i++)
+      convertItem(writer, pending.offset + sizeof(Frame) + i * sizeof(Item *));
+  } else {
+    for (size_t i = 0; i < pending.count; i++)
+      convertItem(writer, pending.offset + i * sizeof(Item *));
+  }
+}
+
+// adds a (variable . value) pair for a global binding to the list at data
+static void addBinding(Item *var, Item *cell, void *data) {
+  Item **bindings = data;
+  *bindings = cons(cons(var, cdr(cell)), *bindings);
+}
+
+static void freeWriter(Writer *writer) {
+  free(writer->data);
+  free(writer->relocations);
+  free(writer->tables);
+  free(writer->pending);
+  free(writer->keys);
+  free(writer->offsets);
+}
+
+// prints an error message about an image and ends the evaluation
+static void imageError(const char *path, const char *message) {
+  fprintf(context->output, "Image error: %s: %s\n", path, message);
+  abandon();
+}
+
+void saveImage(const char *path) {
+  Item *bindings = makeNull();
+  hashTableEach(globalEnvironment()->bindings, addBinding, &bindings);
+
+  Writer writer = {0};
+  ImageHeader header = {.version = IMAGE_VERSION, .itemSize = sizeof(Item),
+                        .globalVersion = context->globalVersion, .bindings = bindings};
+  memcpy(header.magic, imageMagic, sizeof(header.magic));
+  append(&writer, &header, sizeof(header));
+  convertItem(&writer, offsetof(ImageHeader, bindings));
+  while (writer.pendingCount > 0 && writer.failure == NULL)
+    convertPending(&writer, writer.pending[--writer.pendingCount]);
+  if (writer.failure != NULL) {
+    freeWriter(&writer);
+    imageError(path, writer.failure);
+  }
+
+  // the tables go at the end, and the header is filled in with where
+  uint64_t relocations = append(&writer, writer.relocations, writer.relocationCount * sizeof(uint64_t));
+  uint64_t tables = append(&writer, writer.tables, writer.tableCount * sizeof(uint64_t));
+  ImageHeader *final = (ImageHeader *)writer.data;
+  final->relocations = relocations;
+  final->relocationCount = writer.relocationCount;
+  final->tables = tables;
+  final->tableCount = writer.tableCount;
+  final->size = writer.size;
+
+  FILE *file = fopen(path, "wb");
+  bool written = file != NULL && fwrite(writer.data, 1, writer.size, file) == writer.size;
+  if (file != NULL && fclose(file) != 0)
+    written = false;
+  freeWriter(&writer);
+  if (!written)
+    imageError(path, "could not write the file");
+}
+
+// returns the string at offset in an image, or NULL if it runs past the end
+static char *nameAt(Image *image, uint64_t offset) {
+  if (offset >= image->size || memchr(image->base + offset, '\0', image->size - offset) == NULL)
+    return NULL;
+  return image->base + offset;
+}
+
+// patches every word in the relocation table, returning false if the image
+// is malformed
+static bool relocateImage(Image *image, ImageHeader *header, Frame *primitives) {
+  uint64_t *relocations = (uint64_t *)(image->base + header->relocations);
+  for (uint64_t i = 0; i < header->relocationCount; i++) {
+    uint64_t offset = relocations[i] >> RELOCATION_BITS;
+    if (offset % sizeof(void *) != 0 || offset + sizeof(void *) > header->relocations)
+      return false;
+    void **word = (void **)(image->base + offset);
+    uint64_t value = (uint64_t)(uintptr_t)*word;
+    char *name;
+    switch (relocations[i] & ((1 << RELOCATION_BITS) - 1)) {
+    case RELOCATE_POINTER:
+      if (value >= image->size)
+        return false;
+      *word = image->base + value;
+      break;
+    case RELOCATE_SYMBOL:
+      if ((name = nameAt(image, value)) == NULL)
+        return false;
+      *word = intern(name);
+      break;
+    case RELOCATE_NAME:
+      if ((name = nameAt(image, value)) == NULL)
+        return false;
+      *word = intern(name)->s;
+      break;
+    case RELOCATE_PRIMITIVE: {
+      if ((name = nameAt(image, value)) == NULL)
+        return false;
+      Item *cell = hashTableGet(primitives->bindings, intern(name));
+      if (cell == NULL)
+        return false;
+      Item *primitive = cdr(cell);
+      memcpy(word, &primitive->pf.function, sizeof(primitive->pf.function));
+      break;
+    }
+    case RELOCATE_GLOBAL_FRAME:
+      *word = context->globalFrame;
+      break;
+    default:
+      return false;
+    }
+  }
+  uint64_t *tables = (uint64_t *)(image->base + header->tables);
+  for (uint64_t i = 0; i < header->tableCount; i++)
+    if (tables[i] % IMAGE_ALIGNMENT != 0 || tables[i] + sizeof(Item) > header->relocations)
+      return false;
+  return true;
+}
+
+void loadImage(const char *path) {
+  int file = open(path, O_RDONLY);
+  if (file < 0)
+    imageError(path, "could not open the file");
+  struct stat info;
+  void *map = MAP_FAILED;
+  if (fstat(file, &info) == 0 && (size_t)info.st_size >= sizeof(ImageHeader))
+    map = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+  close(file);
+  if (map == MAP_FAILED)
+    imageError(path, "could not map the file");
+
+  ImageHeader *header = map;
+  if (memcmp(header->magic, imageMagic, sizeof(header->magic)) != 0
+      || header->version != IMAGE_VERSION || header->itemSize != sizeof(Item)
+      || header->size != (uint64_t)info.st_size
+      || header->relocations > header->size
+      || header->relocationCount > (header->size - header->relocations) / sizeof(uint64_t)
+      || header->tables > header->size
+      || header->tableCount > (header->size - header->tables) / sizeof(uint64_t)) {
+    munmap(map, info.st_size);
+    imageError(path, "not an image made by this interpreter");
+  }
+
+  Image *image = malloc(sizeof(Image));
+  if (image == NULL)
+    imageAllocationError();
+  image->base = map;
+  image->size = info.st_size;
+  globalEnvironment();
+  Frame *primitives = primitiveEnvironment();
+  if (!relocateImage(image, header, primitives)) {
+    munmap(map, info.st_size);
+    free(image);
+    imageError(path, "the image is damaged");
+  }
+  image->next = context->images;
+  context->images = image;
+  // keeps alive whatever the image's objects are made to point to
+  tregion(map, info.st_size);
+
+  uint64_t *tables = (uint64_t *)(image->base + header->tables);
+  for (uint64_t i = 0; i < header->tableCount; i++)
+    hashTableRehash((Item *)(image->base + tables[i]));
+  for (Item *binding = header->bindings; typeOf(binding) == CONS_TYPE; binding = cdr(binding))
+    defineGlobal(car(car(binding)), cdr(car(binding)));
+
+  // caches in the image hold counts up to the one it was made at, which must
+  // not be taken for current ones here
+  if (context->globalVersion < header->globalVersion)
+    context->globalVersion = header->globalVersion;
+  bumpGlobalVersion();
+}
+
+void freeImages(Image *images) {
+  while (images != NULL) {
+    Image *next = images->next;
+    munmap(images->base, images->size);
+    free(images);
+    images = next;
+  }
+}
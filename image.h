@@ -0,0 +1,23 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+// An image holds the current context's global bindings and everything they
+// reach (closures with their code and frames, lists, strings, vectors, hash
+// tables and numbers) in a file that a later run maps into memory and uses
+// where it lies, instead of evaluating the program that made them.
+//
+// Pointers within an image are stored as offsets from its start, and symbols
+// and primitives by name, so loading only has to patch those words in place.
+
+// Writes an image of the current context to the file at path.
+void saveImage(const char *path);
+
+// Maps the image at path and binds every global variable saved in it in the
+// current context, replacing any binding of the same name.
+void loadImage(const char *path);
+
+// Unmaps the images loaded into a context, once it is freed.
+struct Image;
+void freeImages(struct Image *images);
+
+#endif
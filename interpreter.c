@@ -1,523 +1,574 @@
-#include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "item.h"
 #include "linkedlist.h"
 #include "talloc.h"
 #include "parser.h"
 #include "interpreter.h"
+#include "symbols.h"
+#include "vm.h"
+#include "bignum.h"
+#include "vector.h"
+#include "hashtable.h"
+#include "future.h"
+#include "context.h"
 #include <assert.h>
 
-// throws an error and exits
+// reports an error and ends the evaluation
 void evaluationError(char* mes) {
-  printf("Evaluation error: %s\n", mes);
-  texit(1);
+  fprintf(context->output, "Evaluation error: %s\n", mes);
+  abandon();
 }
 
-// primitive functions
+void arityError(Item *primitive, int argc) {
+  char message[128];
+  int least = primitive->pf.minArgs, most = primitive->pf.maxArgs;
+  if (most < 0)
+    snprintf(message, sizeof(message), "%s takes at least %d argument%s",
+             primitive->pf.name, least, least == 1 ? "" : "s");
+  else if (least == most)
+    snprintf(message, sizeof(message), "%s takes %d argument%s",
+             primitive->pf.name, least, least == 1 ? "" : "s");
+  else
+    snprintf(message, sizeof(message), "%s takes %d to %d arguments",
+             primitive->pf.name, least, most);
+  evaluationError(message);
+}
 
-Item *primitiveNull(Item *args) {
-  if(length(args) != 1) evaluationError("null? takes 1 argument");
-  Item *result = makeNull();
-  result->type = BOOL_TYPE;
-  result->i = isNull(car(args));
+// makes a heap item holding a double
+Item *makeDouble(double value) {
+  Item *result = makeItem(DOUBLE_TYPE);
+  result->d = value;
   return result;
 }
 
-Item *primitiveCar(Item *args) {
-  if(length(args) != 1) evaluationError("car takes 1 argument");
-  if(car(args)->type != CONS_TYPE) evaluationError("car argument must be cons cell");
-  return car(car(args));
+// primitive functions
+
+Item *primitiveNull(int argc, Item **argv) {
+  return makeBool(isNull(argv[0]));
+}
+
+Item *primitiveCar(int argc, Item **argv) {
+  if(typeOf(argv[0]) != CONS_TYPE) evaluationError("car argument must be cons cell");
+  return car(argv[0]);
 }
 
-Item *primitiveCdr(Item *args) {
-  if(length(args) != 1)
-    evaluationError("cdr takes 1 argument");
-  if(car(args)->type != CONS_TYPE)
+Item *primitiveCdr(int argc, Item **argv) {
+  if(typeOf(argv[0]) != CONS_TYPE)
     evaluationError("cdr argument must be cons cell");
-  return cdr(car(args));
+  return cdr(argv[0]);
 }
 
-Item *primitiveCons(Item *args) {
-  if(length(args) != 2) evaluationError("cons takes 2 argument");
-  return cons(car(args), car(cdr(args)));
+Item *primitiveCons(int argc, Item **argv) {
+  return cons(argv[0], argv[1]);
 }
 
 
-Item *primitiveAppend(Item *args) {
-  if(length(args) != 2) evaluationError("append takes 2 argument");
+Item *primitiveAppend(int argc, Item **argv) {
   Item *newList = makeNull();
-  Item *cur = car(args);
-  while(cur->type == CONS_TYPE) {
+  Item *cur = argv[0];
+  while(typeOf(cur) == CONS_TYPE) {
     newList=cons(car(cur),newList);
     cur=cdr(cur);
   }
-  if(cur->type != NULL_TYPE)
+  if(typeOf(cur) != NULL_TYPE)
     evaluationError("append takes a null-terminated list in first argument");
   cur = newList;
-  Item *result=car(cdr(args));
-  while(cur->type==CONS_TYPE) {
+  Item *result=argv[1];
+  while(typeOf(cur)==CONS_TYPE) {
     result=cons(car(cur),result);
     cur=cdr(cur);
   }
   return result;
 }
 
-Item *primitivePlus(Item *args) {
-  double sum = 0;//every 32bit integer can be represented as a double
-  bool is_double = false;
-  while(args->type == CONS_TYPE) {
-    if(car(args)->type != DOUBLE_TYPE && car(args)->type != INT_TYPE) evaluationError("+ only takes numbers as arguments");
-    if(car(args)->type == DOUBLE_TYPE) {
-      is_double = true;
-      sum += car(args)->d;
-    } else {
-      sum += (double)car(args)->i;
+// Numbers are fixnums, bignums or doubles. Arithmetic on two fixnums is done
+// inline and only falls back to the bignum code when the result would not
+// fit; a double anywhere makes the result a double.
+
+// returns true if item is a number
+static inline bool isNumber(Item *item) {
+  itemType type = typeOf(item);
+  return type == INT_TYPE || type == BIGNUM_TYPE || type == DOUBLE_TYPE;
+}
+
+// returns true if item is an exact integer
+static inline bool isExactInteger(Item *item) {
+  return typeOf(item) == INT_TYPE || typeOf(item) == BIGNUM_TYPE;
+}
+
+// converts a number to a double
+double numberValue(Item *item) {
+  if(typeOf(item) == DOUBLE_TYPE)
+    return item->d;
+  return integerToDouble(item);
+}
+
+Item *addNumbers(Item *a, Item *b) {
+  if(typeOf(a) == INT_TYPE && typeOf(b) == INT_TYPE) {
+    // two fixnums have a sum that fits in a long
+    long sum = intValue(a) + intValue(b);
+    if(sum >= FIXNUM_MIN && sum <= FIXNUM_MAX)
+      return makeInt(sum);
+  }
+  if(typeOf(a) == DOUBLE_TYPE || typeOf(b) == DOUBLE_TYPE)
+    return makeDouble(numberValue(a) + numberValue(b));
+  return integerAdd(a, b);
+}
+
+Item *negateNumber(Item *a) {
+  if(typeOf(a) == DOUBLE_TYPE)
+    return makeDouble(-a->d);
+  if(typeOf(a) == INT_TYPE && intValue(a) != FIXNUM_MIN)
+    return makeInt(-intValue(a));
+  return integerSubtract(makeInt(0), a);
+}
+
+Item *multiplyNumbers(Item *a, Item *b) {
+  if(typeOf(a) == INT_TYPE && typeOf(b) == INT_TYPE) {
+    long x = intValue(a), y = intValue(b), product;
+#ifdef __GNUC__
+    if(!__builtin_mul_overflow(x, y, &product)
+       && product >= FIXNUM_MIN && product <= FIXNUM_MAX)
+      return makeInt(product);
+#else
+    if(labs(x) < (1L << 31) && labs(y) < (1L << 31)) {
+      product = x * y;
+      if(product >= FIXNUM_MIN && product <= FIXNUM_MAX)
+        return makeInt(product);
     }
-    args=cdr(args);
+#endif
   }
-  Item *result = makeNull();
-  if(is_double) {
-    result->type = DOUBLE_TYPE;
-    result->d = sum;
-  } else {
-    result->type = INT_TYPE;
-    result->i = (int)sum;
+  if(typeOf(a) == DOUBLE_TYPE || typeOf(b) == DOUBLE_TYPE)
+    return makeDouble(numberValue(a) * numberValue(b));
+  return integerMultiply(a, b);
+}
+
+// returns a negative number, zero or a positive number as a is less than,
+// equal to or greater than b, or 2 if either is a NaN
+int compareNumbers(Item *a, Item *b) {
+  if(typeOf(a) == INT_TYPE && typeOf(b) == INT_TYPE)
+    return (intValue(a) > intValue(b)) - (intValue(a) < intValue(b));
+  if(typeOf(a) == DOUBLE_TYPE || typeOf(b) == DOUBLE_TYPE) {
+    double x = numberValue(a), y = numberValue(b);
+    if(x < y) return -1;
+    if(x > y) return 1;
+    return x == y ? 0 : 2;
   }
-  return result;
+  return integerCompare(a, b);
 }
 
-Item *primitiveMinus(Item *args) {
-  if(args->type!=CONS_TYPE) evaluationError("primitive - requires atleast one argument");
-  Item *lead=car(args);
-  Item *newLead=makeNull();
-  if(lead->type==INT_TYPE) {
-    newLead->type=INT_TYPE;
-    newLead->i=-(lead->i);
-  } else if(lead->type==DOUBLE_TYPE) {
-    newLead->type=DOUBLE_TYPE;
-    newLead->d=-(lead->d);
+Item *primitivePlus(int argc, Item **argv) {
+  Item *sum = makeInt(0);
+  for(int i = 0; i < argc; i++) {
+    if(!isNumber(argv[i])) evaluationError("+ only takes numbers as arguments");
+    sum = addNumbers(sum, argv[i]);
   }
-  Item *result = primitivePlus(cons(newLead,cdr(args)));
-  if(result->type==INT_TYPE)
-    result->i=-result->i;
-  else if(result->type==DOUBLE_TYPE)
-    result->d=-result->d;
-  return result;
+  return sum;
 }
 
-Item *primitiveMult(Item *args) {
-  double product=1;
-  bool sawDouble=false;
-  while(args->type!=NULL_TYPE) {
-    if(car(args)->type==INT_TYPE)
-      product*=(double)car(args)->i;
-    if(car(args)->type==DOUBLE_TYPE) {
-      sawDouble=true;
-      product*=car(args)->d;
-    }
-    args=cdr(args);
+Item *primitiveMinus(int argc, Item **argv) {
+  // the lead is negated, the rest added to it and the sum negated
+  Item *sum = argv[0];
+  for(int i = 0; i < argc; i++) {
+    if(!isNumber(argv[i])) evaluationError("- only takes numbers as arguments");
+    sum = i == 0 ? negateNumber(sum) : addNumbers(sum, argv[i]);
   }
-  Item *result=makeNull();
-  if(sawDouble){
-    result->type=DOUBLE_TYPE;
-    result->d=product;
-  } else {
-    result->type=INT_TYPE;
-    result->i=(int)product;
+  return negateNumber(sum);
+}
+
+Item *primitiveMult(int argc, Item **argv) {
+  Item *product=makeInt(1);
+  for(int i = 0; i < argc; i++) {
+    if(isNumber(argv[i]))
+      product=multiplyNumbers(product,argv[i]);
   }
-  return result;
+  return product;
 }
 
-Item *primitiveDiv(Item *args) {
-  if(length(args)!=2)
-    evaluationError("/ only supports 2 arguments");
-  Item *result=makeNull();
-  if(car(args)->type==INT_TYPE
-     && car(cdr(args))->type == INT_TYPE
-     && car(args)->i % car(cdr(args))->i ==0) {
-    result->type=INT_TYPE;
-    result->i = div(car(args)->i,car(cdr(args))->i).quot;
-  } else {
-    double x,y;
-    if(car(args)->type==INT_TYPE) {
-      x=(double)car(args)->i;
-    } else if(car(args)->type==DOUBLE_TYPE) {
-      x=(double)car(args)->d;
-    } else evaluationError("/ requires two numerical arguments");
-    if(car(cdr(args))->type==INT_TYPE) {
-      y=(double)car(cdr(args))->i;
-    } else if(car(cdr(args))->type==DOUBLE_TYPE) {
-      y=(double)car(cdr(args))->d;
-    } else evaluationError("/ requires two numerical arguments");
-    result->type=DOUBLE_TYPE;
-    result->d=x/y;
+Item *primitiveDiv(int argc, Item **argv) {
+  Item *x=argv[0];
+  Item *y=argv[1];
+  if(!isNumber(x) || !isNumber(y))
+    evaluationError("/ requires two numerical arguments");
+  if(isExactInteger(x) && isExactInteger(y)) {
+    // an exact quotient stays an integer
+    if(y==makeInt(0))
+      evaluationError("division by zero");
+    if(typeOf(x)==INT_TYPE && typeOf(y)==INT_TYPE) {
+      if(intValue(y) == -1)
+        return negateNumber(x);
+      if(intValue(x) % intValue(y) == 0)
+        return makeInt(ldiv(intValue(x),intValue(y)).quot);
+    } else {
+      Item *quotient, *remainder;
+      integerDivide(x,y,&quotient,&remainder);
+      if(remainder==makeInt(0))
+        return quotient;
+    }
   }
-  return result;
+  return makeDouble(numberValue(x)/numberValue(y));
 }
 
 //prints the remainder of two integers
-Item *primitiveModulo(Item *args) {
-  if(length(args)!=2)
-    evaluationError("modulo only supports 2 arguments");
-  if(car(args)->type!=INT_TYPE || car(cdr(args))->type!=INT_TYPE)
+Item *primitiveModulo(int argc, Item **argv) {
+  Item *x=argv[0];
+  Item *y=argv[1];
+  if(!isExactInteger(x) || !isExactInteger(y))
     evaluationError("modulo only supports integer arguments");
-  Item *result=makeNull();
-  result->type=INT_TYPE;
-  result->i=car(args)->i % car(cdr(args))->i;
-  return result;
+  if(y==makeInt(0))
+    evaluationError("division by zero");
+  if(typeOf(x)==INT_TYPE && typeOf(y)==INT_TYPE)
+    return makeInt(intValue(x) % intValue(y));
+  Item *quotient, *remainder;
+  integerDivide(x,y,&quotient,&remainder);
+  return remainder;
 }
 
-
-Item *primitiveLessThan(Item *args) {
-  if(args->type!=CONS_TYPE)
-    evaluationError("primitive < requires atleast one argument");
-  double current=0.0/0.0;//initialize to NaN. always compares false
-  while(args->type==CONS_TYPE) {
-    if(car(args)->type !=INT_TYPE
-       && car(args)->type !=DOUBLE_TYPE)
-      evaluationError("primitive < requires numbers as arguments");
-    else if(car(args)->type==INT_TYPE) {
-      if(current >= (double)car(args)->i) break;
-      current=(double)car(args)->i;
-    } else if(car(args)->type==DOUBLE_TYPE) {
-      if(current >= car(args)->d) break;
-      current=car(args)->d;
-    }
-    args=cdr(args);
+// returns true if compareNumbers gives wanted for every neighbouring pair of
+// the argc numbers at argv
+Item *compareChain(int argc, Item **argv, int wanted, char *message) {
+  for(int i = 0; i < argc; i++) {
+    if(!isNumber(argv[i]))
+      evaluationError(message);
+    if(i > 0 && compareNumbers(argv[i-1],argv[i])!=wanted)
+      return FALSE_ITEM;
   }
-  Item *result=makeNull();
-  result->type=BOOL_TYPE;
-  result->i=isNull(args);
-  return result;
+  return TRUE_ITEM;
 }
 
-Item *primitiveGreaterThan(Item *args) {
-  if(args->type!=CONS_TYPE)
-    evaluationError("primitive > requires atleast one argument");
-  double current=0.0/0.0;//initialize to NaN. always compares false
-  while(args->type==CONS_TYPE) {
-    if(car(args)->type !=INT_TYPE
-       && car(args)->type !=DOUBLE_TYPE)
-      evaluationError("primitive > requires numbers as arguments");
-    else if(car(args)->type==INT_TYPE) {
-      if(current <= (double)car(args)->i) break;
-      current=(double)car(args)->i;
-    } else if(car(args)->type==DOUBLE_TYPE) {
-      if(current <= car(args)->d) break;
-      current=car(args)->d;
-    }
-    args=cdr(args);
-  }
-  Item *result=makeNull();
-  result->type=BOOL_TYPE;
-  result->i=isNull(args);
-  return result;
+Item *primitiveLessThan(int argc, Item **argv) {
+  return compareChain(argc,argv,-1,"primitive < requires numbers as arguments");
 }
 
-Item *primitiveEqualTo(Item *args) {
-  if(args->type!=CONS_TYPE)
-    evaluationError("primitive = requires atleast one argument");
-  double current;
-  if(car(args)->type == INT_TYPE)
-    current=(double)car(args)->i;
-  if(car(args)->type == DOUBLE_TYPE)
-    current=car(args)->d;
-  while(args->type==CONS_TYPE) {
-    if(car(args)->type !=INT_TYPE
-       && car(args)->type !=DOUBLE_TYPE)
-      evaluationError("primitive = requires numbers as arguments");
-    else if(car(args)->type==INT_TYPE) {
-      if(current != (double)car(args)->i) break;
-      current=(double)car(args)->i;
-    } else if(car(args)->type==DOUBLE_TYPE) {
-      if(current != car(args)->d) break;
-      current=car(args)->d;
-    }
-    args=cdr(args);
-  }
-  Item *result=makeNull();
-  result->type=BOOL_TYPE;
-  result->i=isNull(args);
-  return result;
+Item *primitiveGreaterThan(int argc, Item **argv) {
+  return compareChain(argc,argv,1,"primitive > requires numbers as arguments");
 }
 
-//binds a single var to evaluated expr in frame 
-void bind(Item *var, Item *expr, Frame *frame) {
-    if(var->type!=SYMBOL_TYPE)
+Item *primitiveEqualTo(int argc, Item **argv) {
+  return compareChain(argc,argv,0,"primitive = requires numbers as arguments");
+}
+
+//binds a single var to evaluated expr in the global frame. Each variable has
+//one binding, a mutable (var . value) cell, which a later define or set!
+//updates in place.
+static void bind(Item *var, Item *expr, Frame *frame) {
+    if(typeOf(var)!=SYMBOL_TYPE)
       evaluationError("tried to bind expr to non-symbol");
-    //add binding
-    Item *binding = cons(var,cons(expr,makeNull()));
-    frame->bindings=cons(binding,frame->bindings);
-}
-
-//takes a linked list of strings with var names and evaluated expressions
-//and adds bindings for all in frame, checking for duplicates
-void bindList(Item *vars, Item *exprs, Frame *frame) 
-{
-  assert(length(vars)==length(exprs));
-  Item *symbolSearch;
-  while(vars->type == CONS_TYPE) {
-    //check for duplicates
-    symbolSearch=cdr(vars);
-    while(symbolSearch->type==CONS_TYPE) {
-      if(!strcmp(car(symbolSearch)->s,car(vars)->s))
-        evaluationError("duplicate bound variable in bind");
-      symbolSearch=cdr(symbolSearch);
-    }
-    bind(car(vars),car(exprs),frame);
-    vars=cdr(vars);
-    exprs=cdr(exprs);
-  }
+    Item *cell = hashTableGet(frame->bindings,var);
+    if(cell!=NULL)
+      cell->c.cdr=expr;
+    else
+      hashTableSet(frame->bindings,var,cons(var,expr));
+    bumpGlobalVersion();
 }
 
-//maps eval over trees
-Item *multiEval(Item *trees, Frame *frame) {
-  Item *result=makeNull();
-  while(trees->type==CONS_TYPE) {
-    result=cons(eval(car(trees),frame),result);
-    trees=cdr(trees);
-  }
-  return reverse(result);
-}
-
-Item *parseBindings(Item *bindings) {
-  Item *vars=makeNull();
-  Item *exprs=makeNull();
-  while(bindings->type==CONS_TYPE) {
-    Item *binding = car(bindings);
-    if (binding->type != CONS_TYPE
-        || length(binding) != 2)
-      evaluationError("incorrect binding format in let");
-    vars=cons(car(binding),vars);
-    exprs=cons(car(cdr(binding)),exprs);
-    bindings=cdr(bindings);
+//makes a frame with size empty slots below parent
+Frame *makeFrame(Frame *parent, int size) {
+  Frame *frame = tallocObject(sizeof(Frame) + size * sizeof(Item *), FRAME_OBJECT);
+  frame->parent = parent;
+  frame->bindings = makeNull();
+  frame->size = size;
+  return frame;
+}
+
+//returns the frame a lexical address refers to
+Frame *addressFrame(Item *local, Frame *frame) {
+  for (int depth = local->la.depth; depth > 0; depth--)
+    frame = frame->parent;
+  return frame;
+}
+
+//evaluates every expression of body but the last in frame, for effect, and
+//returns the last one for the caller to evaluate in tail position
+Item *leadingBody(Item *body, Frame *frame) {
+  while(typeOf(cdr(body))==CONS_TYPE) {
+    eval(car(body),frame);
+    body=cdr(body);
   }
-  if (bindings->type != NULL_TYPE)
-    evaluationError("binding list is not null-terminated in let");
-  return cons(vars,exprs);
-}
-
-//evaluates a let form
-Item *evalLet(Item *args, Frame *frame) {
-  if (length(args) < 2)
-    evaluationError("too few arguments for let");
-  
-  Item *bindings=parseBindings(car(args));
-  Item *vars=car(bindings);
-  Item *exprs=multiEval(cdr(bindings),frame);
-
-  
-  Frame *newFrame=talloc(sizeof(Frame));
-  newFrame->parent=frame;
-  newFrame->bindings=makeNull();
-
-  bindList(vars,exprs,newFrame);
-
-  //evaluate bodys and return result of last S-expression
-  Item *bodys=cdr(args);
-  Item *result= multiEval(bodys,newFrame);
-  while(cdr(result)->type==CONS_TYPE)
-    result=cdr(result);
-  return car(result);
-}
-
-Item *evalLetStar(Item *args, Frame *frame) {
-  if (length(args) < 2)
-          evaluationError("too few arguments for let");
-
-  Item *bindings=parseBindings(car(args));
-  Item *vars=car(bindings);
-  Item *exprs=cdr(bindings);
-
-
-  // bind each var-expr pair to a new frame of its own, with parents chained
-  vars=reverse(vars);
-  exprs=reverse(exprs);
-  Frame *newFrame;
-  while (vars->type == CONS_TYPE) {
-          newFrame = talloc(sizeof(Frame));
-          newFrame->parent = frame;
-          newFrame->bindings = makeNull();
-          bind(car(vars), eval(car(exprs), frame), newFrame);
-          vars=cdr(vars);
-          exprs=cdr(exprs);
-          frame=newFrame;
+  return car(body);
+}
+
+//makes the frame for a let form, analysed into (frameSize exprs . bodys);
+//the values go in the first slots of the new frame
+Frame *bindLet(Item *args, Frame *frame) {
+  Frame *newFrame=makeFrame(frame, intValue(car(args)));
+  Item *exprs=car(cdr(args));
+  for(int slot=0; typeOf(exprs)==CONS_TYPE; slot++) {
+    newFrame->slots[slot]=eval(car(exprs),frame);
+    exprs=cdr(exprs);
   }
+  return newFrame;
+}
 
-  //evaluate bodys and return result of last S-expression
-  Item *bodys=cdr(args);
-  Item *result= multiEval(bodys,newFrame);
-  while(cdr(result)->type==CONS_TYPE)
-    result=cdr(result);
-  return car(result);
+Frame *bindLetStar(Item *args, Frame *frame) {
+  // each expr is evaluated in the new frame, seeing the slots filled
+  // before it
+  Frame *newFrame=makeFrame(frame, intValue(car(args)));
+  Item *exprs=car(cdr(args));
+  for(int slot=0; typeOf(exprs)==CONS_TYPE; slot++) {
+    newFrame->slots[slot]=eval(car(exprs),newFrame);
+    exprs=cdr(exprs);
+  }
+  return newFrame;
 }
 
 //what the fuck???
 //The description on the site makes no sense for letrec ¯\_(ツ)_/¯
-Item *evalLetRec(Item *args, Frame *frame) {
-  if (length(args) < 2)
-          evaluationError("too few arguments for let");
-  Item *bindings=parseBindings(car(args));
-  Item *vars=car(bindings);
-  Item *exprs=cdr(bindings);
-  Frame *newFrame=talloc(sizeof(Frame));
-  newFrame->parent=frame;
-  newFrame->bindings=makeNull();
-  exprs=multiEval(exprs,newFrame);
-  bindList(vars,exprs,newFrame);
-
-  //evaluate bodys and return result of last S-expression
-  Item *bodys=cdr(args);
-  Item *result= multiEval(bodys,newFrame);
-  while(cdr(result)->type==CONS_TYPE)
-    result=cdr(result);
-  return car(result);
-}
-
-Item *evalAnd(Item *args, Frame *frame) {
-  Item *result=makeNull();
-  result->type=BOOL_TYPE;
-  result->i=true;
-  while(args->type==CONS_TYPE) {
-    result=eval(car(args),frame);
-    if(result->type==BOOL_TYPE && result->i==false)
-      break;
-    args=cdr(args);
+//every expr is evaluated in the new frame before any slot is filled; the
+//values wait in an array on the C stack, where the collector sees them
+Frame *bindLetRec(Item *args, Frame *frame) {
+  Frame *newFrame=makeFrame(frame, intValue(car(args)));
+  Item *exprs=car(cdr(args));
+  int count=length(exprs);
+  Item *values[count+1];
+  for(int i=0; i<count; i++, exprs=cdr(exprs))
+    values[i]=eval(car(exprs),newFrame);
+  for(int slot=0; slot<count; slot++)
+    newFrame->slots[slot]=values[slot];
+  return newFrame;
+}
+
+//returns the value bound to a global variable
+Item *lookupGlobal(Item *var) {
+  Item *cell = hashTableGet(context->globalFrame->bindings, var);
+  if (cell == NULL)
+    evaluationError("unbound variable");
+  return cdr(cell);
+}
+
+//records that a global binding has changed since saveGlobals, so that
+//restoreGlobals need only look at those that have
+static void noteGlobalChange(Item *var) {
+  if (context->savedGlobals == NULL)
+    return;
+  if (context->changedGlobals == NULL)
+    context->changedGlobals = makeHashTable(EQ_EQUIVALENCE);
+  hashTableSet(context->changedGlobals, var, var);
+}
+
+//binds a global variable, as a top-level define does
+void defineGlobal(Item *var, Item *value) {
+  noteGlobalChange(var);
+  bind(var, value, context->globalFrame);
+}
+
+//rebinds a global variable that is already bound, as set! does
+void setGlobal(Item *var, Item *value) {
+  Item *cell = hashTableGet(context->globalFrame->bindings, var);
+  if (cell == NULL)
+    evaluationError("unbound variable in set!-form");
+  noteGlobalChange(var);
+  cell->c.cdr = value;
+  bumpGlobalVersion();
+}
+
+//pairs a global's cell with the value in it, in the table of saved bindings
+static void saveBinding(Item *var, Item *cell, void *saved) {
+  hashTableSet(saved, var, cons(cell, cdr(cell)));
+}
+
+//records the global bindings as they stand, for restoreGlobals
+void saveGlobals() {
+  Frame *frame = globalEnvironment();
+  if (context->savedGlobals == NULL) {
+    troot(&context->savedGlobals);
+    troot(&context->changedGlobals);
   }
-  return result;
+  context->savedGlobals = makeHashTable(EQ_EQUIVALENCE);
+  context->changedGlobals = NULL;
+  hashTableEach(frame->bindings, saveBinding, context->savedGlobals);
 }
 
-Item *evalOr(Item *args, Frame *frame) {
-  Item *result=makeNull();
-  result->type=BOOL_TYPE;
-  result->i=false;
-  while(args->type==CONS_TYPE) {
-    result=eval(car(args),frame);
-    if(result->type!=BOOL_TYPE || result->i==true)
-      break;
-    args=cdr(args);
+//puts back the saved value of a global that has changed, or unbinds it if it
+//was defined since. A global keeps its cell once bound, so the saved cell is
+//the one in the table of bindings.
+static void restoreBinding(Item *var, Item *value, void *bindings) {
+  Item *saved = hashTableGet(context->savedGlobals, var);
+  if (saved == NULL) {
+    hashTableDelete(bindings, var);
+    return;
   }
-  return result;
+  Item *cell = car(saved);
+  cell->c.cdr = cdr(saved);
 }
 
-Frame *searchFrame(Item *var, Frame *frame) {
-  Frame *search_frame = frame;
-  Item *binding;
-  while (search_frame != NULL) {
-    binding = search_frame->bindings;
-    while (!isNull(binding)) {
-      if (!strcmp(car(car(binding))->s, var->s)) // this symbol has a binding
-        return search_frame; // stop searching so search_frame refers to the containing
-                    // frame
-      binding = cdr(binding); // check next binding
-    }
-    search_frame = search_frame->parent; // check next frame
-  } // we broke because we ran out of frames to check, so our symbol is unbound
-  evaluationError("unbound variable in set!-form");
-  return frame;//this should never be run
+//puts back the global bindings saveGlobals recorded, touching only those
+//changed since, so that it takes no longer however many globals there are
+void restoreGlobals() {
+  if (context->savedGlobals == NULL || context->changedGlobals == NULL)
+    return;
+  hashTableEach(context->changedGlobals, restoreBinding, context->globalFrame->bindings);
+  context->changedGlobals = NULL;
+  bumpGlobalVersion();
 }
 
-Item *evalSetBang(Item *args, Frame *frame) {
-  if (length(args) != 2)
-    evaluationError("set! takes 2 arguments");
+//returns the value of the global variable var called by the call site, from
+//the site's cache if no global binding has changed since it was filled
+static inline Item *cachedGlobal(Item *site, Item *var) {
+  Item *cache = site->sx.cache;
+  long version = context->globalVersion;
+  if (cache != NULL && cache->c.cdr == makeInt(version))
+    return cache->c.car;
+  Item *value = lookupGlobal(var);
+  if (cache != NULL && cache->c.car == value)
+    cache->c.cdr = makeInt(version);
+  else
+    publish(&site->sx.cache, cons(value, makeInt(version)));
+  return value;
+}
 
+//evaluates a set!, analysed into (variable expr), where variable is a
+//lexical address or a global symbol
+Item *evalSetBang(Item *args, Frame *frame) {
   Item *var=car(args);
   Item *expr = eval(car(cdr(args)), frame);
-  Frame *search_frame=searchFrame(var,frame);
-  bind(var, expr, search_frame); // change binding in the closest frame
-                                 // containing a binding for var
-
-  Item *voidReturn = talloc(sizeof(Item));
-  voidReturn->type = VOID_TYPE;
-  return voidReturn;
-}
-
-// bind a primitive function to a symbol in given frame
-void primBind(char *name, Item *(*function)(Item *), Frame *frame) {
-  Item *symbol = talloc(sizeof(Item));
-  symbol->type = SYMBOL_TYPE;
-  symbol->s = name;
-  Item *functionItem = talloc(sizeof(Item));
-  functionItem->type = PRIMITIVE_TYPE;
-  functionItem->pf = function;
+  if (typeOf(var) == LOCAL_TYPE)
+    addressFrame(var, frame)->slots[var->la.slot] = expr;
+  else
+    setGlobal(var, expr);
+
+  return VOID_ITEM;
+}
+
+// bind a primitive function, which takes from minArgs to maxArgs arguments
+// (-1 for no limit), to a symbol in given frame
+void primBind(char *name, Item *(*function)(int, Item **), int minArgs, int maxArgs, Frame *frame) {
+  Item *symbol = intern(name);
+  Item *functionItem = makeItem(PRIMITIVE_TYPE);
+  functionItem->pf = (struct Primitive){function, symbol->s, minArgs, maxArgs};
   bind(symbol, functionItem, frame);
 }
 
-// apply a function and return the value
-Item *apply(Item *function, Item *args) {
-  if (function->type != CLOSURE_TYPE)
-    evaluationError("not a function");
-  Frame *appFrame = talloc(sizeof(Frame));
-  appFrame->parent = function->cl.frame;
-  appFrame->bindings = makeNull();
+// makes the frame for a call of a closure. The closure's code is
+// (frameSize . body) and the argc arguments at argv fill the first slots of
+// the frame.
+Frame *callFrame(Item *function, int argc, Item **argv) {
+  Item *code = function->cl.functionCode;
+  Frame *appFrame = makeFrame(function->cl.frame, intValue(car(code)));
 
-  if (function->cl.paramNames->type == SYMBOL_TYPE) {
+  if (typeOf(function->cl.paramNames) == SYMBOL_TYPE) {
     // variable length args
-
-    Item *val = cons(args, makeNull());
-    Item *binding = cons(function->cl.paramNames, val);
-    appFrame->bindings = cons(binding, appFrame->bindings);
-  } else if (function->cl.paramNames->type == CONS_TYPE) {
+    Item *args = makeNull();
+    for (int i = argc - 1; i >= 0; i--)
+      args = cons(argv[i], args);
+    appFrame->slots[0] = args;
+  } else if (typeOf(function->cl.paramNames) == CONS_TYPE) {
     // set list of args (or no args)
     Item *parNames = function->cl.paramNames;
-    while (args->type == CONS_TYPE && parNames->type == CONS_TYPE) {
-      // construct binding
-      Item *val = cons(car(args), makeNull());
-      Item *binding = cons(car(parNames), val);
-      appFrame->bindings = cons(binding, appFrame->bindings);
-      args = cdr(args);
+    int slot = 0;
+    while (slot < argc && typeOf(parNames) == CONS_TYPE) {
+      appFrame->slots[slot] = argv[slot];
+      slot++;
       parNames = cdr(parNames);
     }
-    if (args->type == CONS_TYPE)
+    if (slot < argc)
       evaluationError("too many arguments given");
-    if (parNames->type == CONS_TYPE)
+    if (typeOf(parNames) == CONS_TYPE)
       evaluationError("not enough arguments given");
-  } else if (function->cl.paramNames->type != NULL_TYPE) {
+  } else if (typeOf(function->cl.paramNames) != NULL_TYPE) {
     evaluationError("invalid parameter names");
   }
+  return appFrame;
+}
+
+// apply a function and return the value
+Item *apply(Item *function, int argc, Item **argv) {
+  if (typeOf(function) == PRIMITIVE_TYPE)
+    return callPrimitive(function, argc, argv);
+  if (typeOf(function) != CLOSURE_TYPE)
+    evaluationError("not a function");
+  // a closure made by the VM runs there
+  if (typeOf(function->cl.functionCode) == CODE_TYPE)
+    return vmApply(function, argc, argv);
+  Frame *appFrame = callFrame(function, argc, argv);
+  Item *body = cdr(function->cl.functionCode);
+  return eval(leadingBody(body, appFrame), appFrame);
+}
+
+// makes a frame with every primitive bound in it
+Frame *primitiveEnvironment() {
+  Frame *frame = makeFrame(NULL, 0);
+  frame->bindings = makeHashTable(EQ_EQUIVALENCE);
+
+  // set primitive bindings
+  primBind("+", primitivePlus, 0, -1, frame);
+  primBind("null?", primitiveNull, 1, 1, frame);
+  primBind("car", primitiveCar, 1, 1, frame);
+  primBind("cdr", primitiveCdr, 1, 1, frame);
+  primBind("cons", primitiveCons, 2, 2, frame);
+  primBind("append", primitiveAppend, 2, 2, frame);
+  primBind("-", primitiveMinus, 1, -1, frame);
+  primBind("<", primitiveLessThan, 1, -1, frame);
+  primBind(">", primitiveGreaterThan, 1, -1, frame);
+  primBind("=", primitiveEqualTo, 1, -1, frame);
+  primBind("*", primitiveMult, 0, -1, frame);
+  primBind("/", primitiveDiv, 2, 2, frame);
+  primBind("modulo", primitiveModulo, 2, 2, frame);
+  primBind("make-vector", primitiveMakeVector, 1, 2, frame);
+  primBind("vector", primitiveVector, 0, -1, frame);
+  primBind("vector-ref", primitiveVectorRef, 2, 2, frame);
+  primBind("vector-set!", primitiveVectorSet, 3, 3, frame);
+  primBind("vector-length", primitiveVectorLength, 1, 1, frame);
+  primBind("vector-fill!", primitiveVectorFill, 2, 2, frame);
+  primBind("vector->list", primitiveVectorToList, 1, 1, frame);
+  primBind("list->vector", primitiveListToVector, 1, 1, frame);
+  primBind("vector-sort!", primitiveVectorSort, 2, 2, frame);
+  primBind("eq?", primitiveEq, 1, -1, frame);
+  primBind("eqv?", primitiveEqv, 1, -1, frame);
+  primBind("equal?", primitiveEqual, 1, -1, frame);
+  primBind("string=?", primitiveStringEqual, 1, -1, frame);
+  primBind("make-hash-table", primitiveMakeHashTable, 0, 2, frame);
+  primBind("hash-table-ref", primitiveHashTableRef, 2, 3, frame);
+  primBind("hash-table-ref/default", primitiveHashTableRefDefault, 3, 3, frame);
+  primBind("hash-table-set!", primitiveHashTableSet, 3, 3, frame);
+  primBind("hash-table-delete!", primitiveHashTableDelete, 2, 2, frame);
+  primBind("hash-table-contains?", primitiveHashTableContains, 2, 2, frame);
+  primBind("hash-table-exists?", primitiveHashTableContains, 2, 2, frame);
+  primBind("hash-table-update!", primitiveHashTableUpdate, 3, 4, frame);
+  primBind("hash-table-count", primitiveHashTableCount, 1, 1, frame);
+  primBind("hash-table-walk", primitiveHashTableWalk, 2, 2, frame);
+  primBind("future", primitiveFuture, 1, 1, frame);
+  primBind("touch", primitiveTouch, 1, 1, frame);
+  primBind("pmap", primitivePmap, 2, 2, frame);
+  return frame;
+}
+
+// makes the global frame the first time it is called, and returns it
+Frame *globalEnvironment() {
+  if (context->globalFrame != NULL)
+    return context->globalFrame;
+  troot(&context->globalFrame);
+  context->globalFrame = primitiveEnvironment();
+  return context->globalFrame;
+}
 
-  Item *result=multiEval(function->cl.functionCode,appFrame);
-  while(cdr(result)->type==CONS_TYPE)
-    result=cdr(result);
-  return car(result);
+// prints the value of a top-level expression, unless it has none
+void printResult(Item *result) {
+  if(typeOf(result)!=VOID_TYPE && typeOf(result)!=NULL_TYPE)
+    printTree(cons(result,makeNull()));
 }
 
 // takes in a list of S-expressions in the form of abstract syntax trees,
 // calls eval on each, and prints the result.
 void interpret(Item *tree) {
-  Frame *frame = talloc(sizeof(Frame));
-  frame->bindings = makeNull();
-  frame->parent = NULL;
-
-  // set primitive bindings
-  primBind("+", primitivePlus, frame);
-  primBind("null?", primitiveNull, frame);
-  primBind("car", primitiveCar, frame);
-  primBind("cdr", primitiveCdr, frame);
-  primBind("cons", primitiveCons, frame);
-  primBind("append", primitiveAppend, frame);
-  primBind("-", primitiveMinus, frame);
-  primBind("<", primitiveLessThan, frame);
-  primBind(">", primitiveGreaterThan, frame);
-  primBind("=", primitiveEqualTo, frame);
-  primBind("*", primitiveMult, frame);
-  primBind("/", primitiveDiv, frame);
-  primBind("modulo", primitiveModulo, frame);
-
-  Item *result;
-  while(tree->type==CONS_TYPE) {
-    result=eval(car(tree),frame);
-    if(result->type!=VOID_TYPE && result->type!=NULL_TYPE)
-      printTree(cons(result,makeNull()));
+  Frame *frame = globalEnvironment();
+  while(typeOf(tree)==CONS_TYPE) {
+    printResult(eval(car(tree),frame));
     tree=cdr(tree);
  }
 }
 
-// evaluates an S-expression in the form of an abstract syntax tree
+// evaluates an S-expression in the form of an abstract syntax tree. An
+// expression in tail position replaces tree (and frame) and goes round the
+// loop again rather than recursing, so tail calls run in constant C stack.
 Item *eval(Item *tree, Frame *frame) {
-  switch (tree->type) {
+  for (;;) {
+  switch (typeOf(tree)) {
   case INT_TYPE:
+  case BIGNUM_TYPE:
   case DOUBLE_TYPE:
+  case VECTOR_TYPE:
   case STR_TYPE:
   case BOOL_TYPE:
   case CLOSURE_TYPE:
@@ -525,194 +576,178 @@ Item *eval(Item *tree, Frame *frame) {
     return tree;
     break;
   }
+  case LOCAL_TYPE: {
+    // a variable bound by an enclosing lambda or let, at a known slot
+    Item *value = addressFrame(tree, frame)->slots[tree->la.slot];
+    if (value == NULL)
+      evaluationError("unbound variable");
+    return value;
+  }
   case SYMBOL_TYPE: {
-    // Code to implement what should happen if we have a symbol
-    // check through frames for binding of variable
-    Frame *search_frame = frame;
-    while (search_frame != NULL) {
-      Item *binding = search_frame->bindings;
-      while (!isNull(binding)) {
-        if (!strcmp(car(car(binding))->s, tree->s)) // this symbol has a binding
-          return car(cdr(car(binding))); // return the value of the binding
-        binding = cdr(binding);          // check next binding
-      }
-      search_frame = search_frame->parent; // check next frame
-    } // we broke because we ran out of frames to check, so our symbol is
-      // unbound
-    evaluationError("unbound variable");
-    return makeNull();
-    break;
+    // the analyzer leaves symbols only for global variables
+    return lookupGlobal(tree);
   }
-  case CONS_TYPE: {
-    Item *first = car(tree);
-    Item *args = cdr(tree);
-
-    if (first->type == SYMBOL_TYPE) {
-      // if statement
-      if (!strcmp(first->s, "if")) {
-        if (length(args) < 3)
-          evaluationError("too few arguments to if");
-        Item *result = eval(car(args), frame);
-        if (result->type != BOOL_TYPE)
-          evaluationError("conditional in if didn't evaluate to bool");
-        if (result->i)
-          return eval(car(cdr(args)), frame);
-        else
-          return eval(car(cdr(cdr(args))), frame);
+  case SYNTAX_TYPE: {
+    Item *args = tree->sx.args;
+
+    switch (tree->sx.kind) {
+    // if statement
+    case IF_FORM: {
+      Item *result = eval(car(args), frame);
+      if (typeOf(result) != BOOL_TYPE)
+        evaluationError("conditional in if didn't evaluate to bool");
+      if (boolValue(result))
+        tree = car(cdr(args));
+      else
+        tree = car(cdr(cdr(args)));
+      continue;
+    }
+    case COND_FORM: {
+      Item *clause=NULL;
+      Item *result=NULL;
+      while(typeOf(args)==CONS_TYPE) {
+        clause=car(args);
+        result=eval(car(clause),frame);
+        if(typeOf(result)!=BOOL_TYPE
+           || boolValue(result))
+          break;
+        args=cdr(args);
       }
-      if (!strcmp(first->s, "cond")) {
-        while(args->type==CONS_TYPE) {
-          Item *clause=car(args);
-          Item *predicate=car(clause);
-          Item *result;
-          if(isNull(cdr(args))
-              && predicate->type==SYMBOL_TYPE
-              && !strcmp(car(clause)->s,"else")){
-            if(isNull(cdr(clause)))
-              evaluationError("invalid clause in cond");
-            result->type=BOOL_TYPE;
-            result->i=1;
-          } else {
-            result=eval(predicate,frame);
-          }
-          if(result->type!=BOOL_TYPE
-             || result->i==1)
-            {
-              Item *evaledClause=multiEval(cdr(clause),frame);
-            while(evaledClause->type!=NULL_TYPE) {
-              result=car(evaledClause);
-              evaledClause=cdr(evaledClause);
-            }
-            return result;
-          }
-          args=cdr(args);
-        }
-        Item *voidReturn=makeNull();
-        voidReturn->type=VOID_TYPE;
-        return voidReturn;
+      if(typeOf(args)!=CONS_TYPE) {
+        return VOID_ITEM;
       }
+      // a clause with no body gives the value of its test
+      if(isNull(cdr(clause)))
+        return result;
+      tree=leadingBody(cdr(clause),frame);
+      continue;
+    }
 
-      // let statement
-      if (!strcmp(first->s, "let")) {
-        return evalLet(args, frame);
-      }
-      if (!strcmp(first->s, "let*")) {
-        return evalLetStar(args, frame);
-      }
-      if (!strcmp(first->s, "letrec")) {
-        return evalLetRec(args, frame);
-      }
+    // let statement; the body runs in the new frame
+    case LET_FORM:
+      frame = bindLet(args, frame);
+      tree = leadingBody(cdr(cdr(args)), frame);
+      continue;
+    case LETSTAR_FORM:
+      frame = bindLetStar(args, frame);
+      tree = leadingBody(cdr(cdr(args)), frame);
+      continue;
+    case LETREC_FORM:
+      frame = bindLetRec(args, frame);
+      tree = leadingBody(cdr(cdr(args)), frame);
+      continue;
+
+    // check binding exists then its the same as define
+    case SETBANG_FORM:
+      return evalSetBang(args, frame);
+    case SETCAR_FORM: {
+      Item *pair=eval(car(args),frame);
+      Item *obj=car(cdr(args));
+      if(typeOf(pair)!=CONS_TYPE)
+        evaluationError("set-car! requires CONS cell as first input");
+      pair->c.car=eval(obj,frame);
+      return VOID_ITEM;
+    }
+    case SETCDR_FORM: {
+      Item *pair=eval(car(args),frame);
+      Item *obj=car(cdr(args));
+      if(typeOf(pair)!=CONS_TYPE)
+        evaluationError("set-cdr! requires CONS cell as first input");
+      pair->c.cdr=eval(obj,frame);
+      return VOID_ITEM;
+    }
 
-      // check binding exists then its the same as define
-      if (!strcmp(first->s, "set!"))
-        return evalSetBang(args, frame);
-      if (!strcmp(first->s, "set-car!")) {
-        if (length(args) != 2)
-          evaluationError("set-car! takes 2 arguments");
-        Item *pair=eval(car(args),frame);
-        Item *obj=car(cdr(args));
-        if(pair->type!=CONS_TYPE)
-          evaluationError("set-car! requires CONS cell as first input");
-        pair->c.car=eval(obj,frame);
-        Item *voidReturn = talloc(sizeof(Item));
-        voidReturn->type = VOID_TYPE;
-        return voidReturn;
+    // every expression but the last is tested here; the last is in tail
+    // position
+    case AND_FORM: {
+      if(typeOf(args)!=CONS_TYPE) {
+        return TRUE_ITEM;
       }
-      if (!strcmp(first->s, "set-cdr!")) {
-        if (length(args) != 2)
-          evaluationError("set-cdr! takes 2 arguments");
-        Item *pair=eval(car(args),frame);
-        Item *obj=car(cdr(args));
-        if(pair->type!=CONS_TYPE)
-          evaluationError("set-cdr! requires CONS cell as first input");
-        pair->c.cdr=eval(obj,frame);
-        Item *voidReturn = talloc(sizeof(Item));
-        voidReturn->type = VOID_TYPE;
-        return voidReturn;
+      while(typeOf(cdr(args))==CONS_TYPE) {
+        Item *result=eval(car(args),frame);
+        if(result==FALSE_ITEM)
+          return result;
+        args=cdr(args);
       }
-
-      if (!strcmp(first->s, "and"))
-        return evalAnd(args,frame);
-      if (!strcmp(first->s, "or"))
-        return evalOr(args,frame);
-
-      // define statement
-      if (!strcmp(first->s, "define")) {
-        if (length(args) < 2)
-          evaluationError("too few arguments for define");
-        bind(car(args), eval(car(cdr(args)), frame), frame);
-        Item *voidReturn = talloc(sizeof(Item));
-        voidReturn->type = VOID_TYPE;
-        return voidReturn;
+      tree=car(args);
+      continue;
+    }
+    case OR_FORM: {
+      if(typeOf(args)!=CONS_TYPE) {
+        return FALSE_ITEM;
       }
-
-      // lambda statement
-      if (!strcmp(first->s, "lambda")) {
-        if (length(args) < 2)
-          evaluationError("not enough arguments for lambda");
-        Item *closure = talloc(sizeof(Item));
-        closure->type = CLOSURE_TYPE;
-        closure->cl.frame = frame;
-        closure->cl.paramNames = car(args);
-
-        if (closure->cl.paramNames->type == CONS_TYPE) {
-          // check for valid param formatting
-          Item *checkParam = closure->cl.paramNames;
-          while (checkParam->type == CONS_TYPE) {
-            if (car(checkParam)->type != SYMBOL_TYPE)
-              evaluationError("parameter must be symbol");
-
-            // search prev symbols for duplicates
-            Item *searchDup = cdr(checkParam);
-            while (searchDup->type == CONS_TYPE) {
-              if (!strcmp(car(checkParam)->s, car(searchDup)->s))
-                evaluationError("duplicate parameter");
-              searchDup = cdr(searchDup);
-            }
-            checkParam = cdr(checkParam);
-          }
-        } else if (closure->cl.paramNames->type != SYMBOL_TYPE &&
-                   closure->cl.paramNames->type != NULL_TYPE) {
-          evaluationError("parameters must be list");
-        }
-
-        closure->cl.functionCode = cdr(args);
-        return closure;
+      while(typeOf(cdr(args))==CONS_TYPE) {
+        Item *result=eval(car(args),frame);
+        if(result!=FALSE_ITEM)
+          return result;
+        args=cdr(args);
       }
+      tree=car(args);
+      continue;
+    }
 
-      // quote statement
-      if (!strcmp(first->s, "quote")) {
-        if (length(args) != 1)
-          evaluationError("quote takes one argument");
-        return car(args);
-      }
+    // define statement; the analyzer has given a define inside a body a
+    // slot in that body's frame
+    case DEFINE_FORM: {
+      Item *var = car(args);
+      Item *value = eval(car(cdr(args)), frame);
+      if (typeOf(var) == LOCAL_TYPE)
+        addressFrame(var, frame)->slots[var->la.slot] = value;
+      else
+        defineGlobal(var, value);
+      return VOID_ITEM;
     }
 
-    // our symbol is not a special form so we'll evaluate it in the hopes its a
+    // lambda statement; the analyzer has checked the parameters
+    case LAMBDA_FORM: {
+      Item *closure = makeItem(CLOSURE_TYPE);
+      closure->cl.frame = frame;
+      closure->cl.paramNames = car(args);
+      closure->cl.functionCode = cdr(args);
+      return closure;
+    }
+
+    // quote statement
+    case QUOTE_FORM:
+      return args;
+
+    // not a special form so we'll evaluate the first item in the hopes its a
     // primitive or closure
-    first = eval(first, frame);
+    case APPLY_FORM: {
+      // a global callee comes from this call site's cache
+      Item *first = typeOf(car(args)) == SYMBOL_TYPE
+        ? cachedGlobal(tree, car(args))
+        : eval(car(args), frame);
+      args = cdr(args);
 
-    // apply closure
-    if (first->type == CLOSURE_TYPE) {
-      return apply(first, multiEval(args,frame));
-    }
+      // the arguments are evaluated into an array on the C stack, where
+      // the collector sees them
+      int argc = length(args);
+      Item *argv[argc + 1];
+      for (int i = 0; i < argc; i++, args = cdr(args))
+        argv[i] = eval(car(args), frame);
+
+      // apply closure; its body runs in the call frame in place of this
+      // expression
+      if (typeOf(first) == CLOSURE_TYPE) {
+        if (typeOf(first->cl.functionCode) == CODE_TYPE)
+          return vmApply(first, argc, argv);
+        frame = callFrame(first, argc, argv);
+        tree = leadingBody(cdr(first->cl.functionCode), frame);
+        continue;
+      }
 
-    // apply primitive
-    if (first->type == PRIMITIVE_TYPE) {
-      return eval(first, frame)->pf(multiEval(args,frame));
-    }
+      // apply primitive
+      if (typeOf(first) == PRIMITIVE_TYPE) {
+        return callPrimitive(first, argc, argv);
+      }
 
-    else {
       evaluationError("first thing in list wasn't a function or special form");
-      /* // try to apply function */
-      /* Item *evaledArgs = args; */
-      /* while(args->type == CONS_TYPE) { */
-      /*   args->c.car = eval(car(args),frame); */
-      /*   args = cdr(args); */
-      /* } */
-      /* return apply(eval(first, frame), evaledArgs); */
       return makeNull();
     }
+    }
+    evaluationError("unknown special form");
+    return makeNull();
     break;
   }
   default: {
@@ -721,4 +756,5 @@ Item *eval(Item *tree, Frame *frame) {
     break;
   }
   }
+  }
 }
@@ -1,4 +1,5 @@
 #include "item.h"
+#include "context.h"
 
 #ifndef INTERPRETER_H
 #define INTERPRETER_H
@@ -6,5 +7,74 @@
 void interpret(Item *tree);
 Item *eval(Item *tree, Frame *frame);
 
+// Calls a closure or primitive with the argc arguments at argv and returns
+// its value.
+Item *apply(Item *function, int argc, Item **argv);
+
+// Prints an evaluation error message and ends the evaluation.
+void evaluationError(char* mes);
+
+// Reports a call of a primitive with a number of arguments it doesn't take.
+void arityError(Item *primitive, int argc);
+
+// Calls a primitive with the argc arguments at argv, after checking it takes
+// that many. The primitive must read any argument it needs before calling
+// back into the evaluator, since argv may point into the VM's stack, which
+// can move.
+static inline Item *callPrimitive(Item *primitive, int argc, Item **argv) {
+  if (argc < primitive->pf.minArgs
+      || (primitive->pf.maxArgs >= 0 && argc > primitive->pf.maxArgs))
+    arityError(primitive, argc);
+  return primitive->pf.function(argc, argv);
+}
+
+// Makes the global frame, with every primitive bound in it, the first time it
+// is called, and returns it.
+Frame *globalEnvironment();
+
+// Makes a frame like the one the global frame starts as, with every primitive
+// bound in it under its name.
+Frame *primitiveEnvironment();
+
+// Makes a frame with size empty slots whose enclosing frame is parent.
+Frame *makeFrame(Frame *parent, int size);
+
+// The context's globalVersion counts changes to global bindings, so that a
+// value cached along with the count it was looked up at is known to be current
+// while the count is the same. A binding is changed before the count goes up,
+// so a cache filled with the count read before the lookup is never newer than
+// its value.
+static inline void bumpGlobalVersion() {
+#ifdef __GNUC__
+  __atomic_add_fetch(&context->globalVersion, 1, __ATOMIC_RELEASE);
+#else
+  context->globalVersion++;
+#endif
+}
+
+// Stores a freshly made item where other threads may be reading, so that
+// they see it whole. A cache whose value has changed is updated this way, by
+// replacing its pair rather than changing both halves of it.
+static inline void publish(Item **slot, Item *item) {
+#ifdef __GNUC__
+  __atomic_store_n(slot, item, __ATOMIC_RELEASE);
+#else
+  *slot = item;
+#endif
+}
+
+// Return, bind (as define does) and rebind (as set! does) global variables.
+Item *lookupGlobal(Item *var);
+void defineGlobal(Item *var, Item *value);
+void setGlobal(Item *var, Item *value);
+
+// Record the global bindings as they stand, and put them back as they were
+// recorded, undoing every define and set! of a global made since.
+void saveGlobals();
+void restoreGlobals();
+
+// Prints the value of a top-level expression, unless it has none.
+void printResult(Item *result);
+
 #endif
 
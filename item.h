@@ -1,18 +1,28 @@
 #ifndef ITEM_H
 #define ITEM_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 typedef enum {
     INT_TYPE, DOUBLE_TYPE, STR_TYPE, CONS_TYPE, NULL_TYPE, PTR_TYPE,
     OPEN_TYPE, CLOSE_TYPE, BOOL_TYPE, SYMBOL_TYPE, OPENBRACKET_TYPE, CLOSEBRACKET_TYPE,
     DOT_TYPE, SINGLEQUOTE_TYPE,
     VOID_TYPE, CLOSURE_TYPE,
-    PRIMITIVE_TYPE
+    PRIMITIVE_TYPE, SYNTAX_TYPE, LOCAL_TYPE, CODE_TYPE, BIGNUM_TYPE,
+    VECTOR_TYPE, OPENVECTOR_TYPE, HASHTABLE_TYPE, FUTURE_TYPE
 } itemType;
 
+// The kinds of syntax node the analyzer resolves each compound expression to.
+typedef enum {
+    IF_FORM, COND_FORM, LET_FORM, LETSTAR_FORM, LETREC_FORM,
+    SETBANG_FORM, SETCAR_FORM, SETCDR_FORM, AND_FORM, OR_FORM,
+    DEFINE_FORM, LAMBDA_FORM, QUOTE_FORM, APPLY_FORM
+} formKind;
+
 struct Item {
     itemType type;
     union {
-        int i;
         double d;
         char *s;
         void *p;
@@ -27,22 +37,154 @@ struct Item {
             struct Frame *frame;
         } cl;
         
-        // A primitive style function; just a pointer to it, with the right
-        // signature (pf = primitive function)
-        struct Item *(*pf)(struct Item *);
+        // A primitive style function (pf = primitive function): a pointer
+        // to it, which takes its arguments as an array, its name, and the
+        // fewest and most arguments it takes, the most being -1 if there is
+        // no limit
+        struct Primitive {
+            struct Item *(*function)(int argc, struct Item **argv);
+            char *name;
+            int minArgs;
+            int maxArgs;
+        } pf;
+
+        // An analysed compound expression: which form it is, and its
+        // operands in the layout that form's evaluator expects
+        struct Syntax {
+            formKind kind;
+            struct Item *args;
+            // for a call of a global variable, NULL or a (callee . version)
+            // pair caching its value as of that globalVersion
+            struct Item *cache;
+        } sx;
+
+        // A reference to a variable bound by an enclosing lambda or let:
+        // how many frames up it lives and its slot there. The name is kept
+        // for error messages.
+        struct LexicalAddress {
+            int depth;
+            int slot;
+            struct Item *name;
+        } la;
+
+        // Bytecode compiled for the VM: the instructions, the constants they
+        // refer to by index, the size of the frame the code runs in and the
+        // most stack slots it uses. ops starts with a header of CODE_HEADER
+        // words, how many words ops holds and how many constants there are,
+        // and the instructions follow it
+        struct Code {
+            int *ops;
+            struct Item **constants;
+            int frameSize;
+            int maxStack;
+        } cd;
+
+        // An integer too big for a fixnum: its magnitude in base 2^32
+        // digits, least significant first and with no leading zeros, and
+        // its sign
+        struct Bignum {
+            uint32_t *digits;
+            int length;
+            bool negative;
+        } bn;
+
+        // A vector: its elements, a heap array whose every word is traced,
+        // and how many there are
+        struct Vector {
+            struct Item **elements;
+            int length;
+        } vec;
+
+        // A hash table with open addressing: capacity key and value pairs
+        // side by side in a heap array whose every word is traced, how many
+        // of them hold entries, how many are in use including deleted ones,
+        // and which equivalence compares the keys
+        struct HashTable {
+            struct Item **slots;
+            int capacity;
+            int count;
+            int used;
+            int equivalence;
+        } ht;
+
+        // A future: the procedure it runs, the argument it is called with
+        // (NULL for none) until it has run and then its value, and whether
+        // it is waiting to run, running or done
+        struct Future {
+            struct Item *function;
+            struct Item *value;
+            int state;
+        } fu;
     };
 };
 
 typedef struct Item Item;
 
+// the words before a code item's first instruction
+#define CODE_HEADER 2
+
+// Integers, booleans, the empty list and void are immediates: the Item pointer
+// holds the value itself and nothing is allocated. Heap items are at least
+// 8-byte aligned, so the low bits of a pointer tell the two apart. A fixnum
+// has its low bit set and its value in the bits above. Any other immediate
+// has the low bits 10, its type from bit 3 up, and in bit 2 the value of a
+// boolean.
+#define FIXNUM_TAG 1
+#define IMMEDIATE_TAG 2
+#define IMMEDIATE(type, bit) ((Item *)(((uintptr_t)(type) << 3) | ((bit) << 2) | IMMEDIATE_TAG))
+#define FALSE_ITEM IMMEDIATE(BOOL_TYPE, 0)
+#define TRUE_ITEM IMMEDIATE(BOOL_TYPE, 1)
+#define NULL_ITEM IMMEDIATE(NULL_TYPE, 0)
+#define VOID_ITEM IMMEDIATE(VOID_TYPE, 0)
+
+// returns true if item points to memory rather than being an immediate
+static inline bool isHeapItem(Item *item) {
+    return ((uintptr_t)item & (FIXNUM_TAG | IMMEDIATE_TAG)) == 0;
+}
+
+// returns the type of any item, immediate or not
+static inline itemType typeOf(Item *item) {
+    uintptr_t bits = (uintptr_t)item;
+    if(bits & FIXNUM_TAG) return INT_TYPE;
+    if(bits & IMMEDIATE_TAG) return (itemType)(bits >> 3);
+    return item->type;
+}
+
+// the range of a fixnum; integers outside it are bignums
+#define FIXNUM_MAX (INTPTR_MAX >> 1)
+#define FIXNUM_MIN (INTPTR_MIN >> 1)
+
+// converts between integers and fixnums
+static inline Item *makeInt(long value) {
+    return (Item *)(((uintptr_t)value << 1) | FIXNUM_TAG);
+}
+static inline long intValue(Item *item) {
+    return (intptr_t)item >> 1;
+}
+
+// converts between C truth values and booleans
+static inline Item *makeBool(bool value) {
+    return value ? TRUE_ITEM : FALSE_ITEM;
+}
+static inline bool boolValue(Item *item) {
+    return item == TRUE_ITEM;
+}
+
 
-// A frame is a linked list of bindings, and a pointer to another frame.  A
-// binding is a variable name (represented as a string), and a pointer to the
-// Value it is bound to. 
+// A frame holds the variables bound by one lambda call or let, and a pointer
+// to the enclosing frame. The analyzer gives each of those variables a slot,
+// so their values are kept in an array sized when the frame is made; a slot
+// holding NULL has not been assigned yet. The global frame, whose variables
+// are not known ahead of time, instead has its bindings in a hash table keyed
+// by variable name (represented as a symbol, so compared by identity); other
+// frames leave bindings empty. The table maps each name to a (name . value)
+// cell, which define and set! update in place.
 
 struct Frame {
     struct Item *bindings;
     struct Frame *parent;
+    int size;
+    struct Item *slots[];
 };
 
 typedef struct Frame Frame;
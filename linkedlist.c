@@ -3,17 +3,23 @@
 #include <string.h>
 #include "talloc.h"
 #include "linkedlist.h"
+#include "bignum.h"
 
-// Create a null Item
+// Return the empty list, which is an immediate
 Item *makeNull() {
-    Item *item = talloc(sizeof(Item));
-    item->type = NULL_TYPE;
+    return NULL_ITEM;
+}
+
+// Create an Item of the given type on the heap
+Item *makeItem(itemType type) {
+    Item *item = tallocObject(sizeof(Item), ITEM_OBJECT);
+    item->type = type;
     return item;
 }
 
 // Takes in car and cdr Items, returns cons cell
 Item *cons(Item *newCar, Item *newCdr) {
-    Item *item = talloc(sizeof(Item));
+    Item *item = tallocObject(sizeof(Item), ITEM_OBJECT);
     item->type = CONS_TYPE;
     item->c = (struct ConsCell) {newCar, newCdr};
     return item;
@@ -23,9 +29,12 @@ Item *cons(Item *newCar, Item *newCdr) {
 void display(Item *list) {
     printf("(");
     while(!isNull(list)) {
-        switch(car(list)->type) {
+        switch(typeOf(car(list))) {
         case INT_TYPE:
-            printf("%i", car(list)->i);
+            printf("%ld", intValue(car(list)));
+            break;
+        case BIGNUM_TYPE:
+            printInteger(stdout, car(list));
             break;
         case DOUBLE_TYPE:
             printf("%lf", car(list)->d);
@@ -60,20 +69,20 @@ Item *reverse(Item *list) {
 
 // Return car of list
 Item *car(Item *list) {
-    assert(list->type == CONS_TYPE);
+    assert(typeOf(list) == CONS_TYPE);
     return list->c.car;
 }
 
 // Return cdr of list
 Item *cdr(Item *list) {
-    assert(list->type == CONS_TYPE);
+    assert(typeOf(list) == CONS_TYPE);
     return list->c.cdr;
 }
 
 // Returns if item is null
 bool isNull(Item *item) {
     assert(item != NULL);
-    return item->type == NULL_TYPE;
+    return item == NULL_ITEM;
 }
 
 // Returns length of list
@@ -4,9 +4,12 @@
 #ifndef LINKEDLIST_H
 #define LINKEDLIST_H
 
-// Create a new NULL_TYPE item node.
+// Return the empty list. It is an immediate, so this allocates nothing.
 Item *makeNull();
 
+// Create a new heap item of the given type, otherwise zeroed.
+Item *makeItem(itemType type);
+
 // Create a new CONS_TYPE item node.
 Item *cons(Item *newCar, Item *newCdr);
 
@@ -1,17 +1,91 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "tokenizer.h"
 #include "item.h"
 #include "linkedlist.h"
 #include "parser.h"
 #include "talloc.h"
+#include "analyzer.h"
 #include "interpreter.h"
+#include "vm.h"
+#include "context.h"
+#include "scheme.h"
+#include "server.h"
+#include "image.h"
 
-int main() {
+// writes what a step of setting up a server printed to stderr, since stdout
+// may be carrying responses, and returns the step's status
+int setUpStep(int status, char *output) {
+    if(output != NULL) {
+        fputs(output, stderr);
+        free(output);
+    }
+    return status;
+}
+
+int main(int argc, char **argv) {
+    // --vm compiles the program to bytecode and runs it on the VM instead of
+    // walking the tree. The program is read from the file named, if any, or
+    // else from stdin. --serve and --socket instead load the file named as a
+    // prelude and then serve requests, from stdin or from connections to a
+    // Unix-domain socket at the path given. --image binds the globals saved in
+    // an image before anything else runs, and --save-image saves them once
+    // the program has run.
+    bool useVM = false;
+    bool serve = false;
+    char *socketPath = NULL;
+    char *imagePath = NULL;
+    char *saveImagePath = NULL;
+    char *path = NULL;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "--vm") == 0) {
+            useVM = true;
+        } else if(strcmp(argv[i], "--serve") == 0) {
+            serve = true;
+        } else if(strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socketPath = argv[++i];
+        } else if(strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+            imagePath = argv[++i];
+        } else if(strcmp(argv[i], "--save-image") == 0 && i + 1 < argc) {
+            saveImagePath = argv[++i];
+        } else if(path == NULL && argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            fprintf(stderr, "usage: %s [--vm] [--image path] [--save-image path] [--serve | --socket path] [program.scm]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if(serve || socketPath != NULL) {
+        SchemeContext *server = schemeCreate(useVM);
+        char *output;
+        int status = 0;
+        if(imagePath != NULL)
+            status = setUpStep(schemeLoadImage(server, imagePath, &output), output);
+        if(status == 0 && path != NULL)
+            status = setUpStep(schemeLoad(server, path, &output), output);
+        if(status == 0 && saveImagePath != NULL)
+            status = setUpStep(schemeSaveImage(server, saveImagePath, &output), output);
+        if(status != 0)
+            return 1;
+        schemeSave(server);
+        if(socketPath != NULL)
+            return serveSocket(server, socketPath);
+        status = serveStream(server, stdin, stdout);
+        schemeDestroy(server);
+        return status;
+    }
 
-    Item *list = tokenize();
-    Item *tree = parse(list);
-    interpret(tree);
+    // the stack below this frame holds the active eval/apply calls
+    Context *program = makeContext(useVM);
+    enterContext(program, &program);
+    if(imagePath != NULL)
+        loadImage(imagePath);
+    openInput(path);
+    evaluateInput();
+    if(saveImagePath != NULL)
+        saveImage(saveImagePath);
 
-    tfree();
-    return 0;
+    texit(0);
 }
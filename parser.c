@@ -2,97 +2,153 @@
 #include <stdio.h>
 #include "linkedlist.h"
 #include "talloc.h"
+#include "tokenizer.h"
+#include "symbols.h"
+#include "bignum.h"
+#include "vector.h"
+#include "context.h"
 
-//prints syntax error message then exits, freeing all memory used
+//prints syntax error message then ends the evaluation
 void parser_error(char *message) {
-  printf("Syntax error: %s\n", message);
-  texit(1);
+  fprintf(context->output, "Syntax error: %s\n", message);
+  abandon();
 }
 
+void printList(Item *tree);
+
 //prints the value of token tree, depending on the type
 void printToken(Item *tree) {
-  switch (tree->type) {
+  switch (typeOf(tree)) {
   case INT_TYPE:
-    printf("%i",tree->i);
+    fprintf(context->output, "%ld",intValue(tree));
+    break;
+  case BIGNUM_TYPE:
+    printInteger(context->output, tree);
     break;
   case BOOL_TYPE:
-    printf("#%c",tree->i?'t':'f');
+    fprintf(context->output, "#%c",boolValue(tree)?'t':'f');
     break;
   case DOUBLE_TYPE:
-    printf("%lf",tree->d);
+    fprintf(context->output, "%lf",tree->d);
     break;
   case STR_TYPE:
-    printf("\"%s\"",tree->s);
+    fprintf(context->output, "\"%s\"",tree->s);
     break;
   case NULL_TYPE:
-    printf("()");
+    fprintf(context->output, "()");
     break;
   case VOID_TYPE:
     break;
+  case VECTOR_TYPE:
+    fprintf(context->output, "#(");
+    printList(vectorToList(tree));
+    fprintf(context->output, ")");
+    break;
+  case HASHTABLE_TYPE:
+    fprintf(context->output, "#<hash-table>");
+    break;
+  case FUTURE_TYPE:
+    fprintf(context->output, "#<future>");
+    break;
   default:
-    printf("%s",tree->s);
+    fprintf(context->output, "%s",tree->s);
     break;
   }
 }
 
-// Takes a list of tokens from a Scheme program, and returns a pointer to a
-// parse tree representing that program.
-Item *parse(Item *tokens) {
-  Item *stack=makeNull();
-  int nestingLevel=0;
-  while(tokens->type==CONS_TYPE) {
-    Item *token=car(tokens);
-    if (token->type == OPEN_TYPE || token->type == OPENBRACKET_TYPE)
-      nestingLevel++;
-    if(token->type==CLOSE_TYPE) {
-      if(nestingLevel<=0) parser_error("too many close parentheses");
-      token=makeNull();
-      while(car(stack)->type!=OPEN_TYPE) {
-        token=cons(car(stack),token);//make token into a reversed list of
-                                       //things on the stack
-        if(cdr(stack)->type!=CONS_TYPE) parser_error("too many close parentheses");
-        stack=cdr(stack);//pop the open off the stack
+Item *readFrom(Item *token);
+
+// returns the next token, which must be there
+Item *expectToken() {
+  Item *token=nextToken();
+  if(token==NULL) parser_error("not enough close parentheses");
+  return token;
+}
 
-        }
-        nestingLevel--;
-      stack=cdr(stack);
-    } else if(token->type==CLOSEBRACKET_TYPE) {
-      if(nestingLevel<=0) parser_error("too many close parentheses");
-      token=makeNull();
-      while(car(stack)->type!=OPENBRACKET_TYPE) {
-        token=cons(car(stack),token);//make token into a reversed list of
-                                       //things on the stack
-        if(cdr(stack)->type!=CONS_TYPE) parser_error("too many close parentheses");
-        stack=cdr(stack);//pop the openbracket off the stack
-      }
-      nestingLevel--;
-      stack=cdr(stack);
+// reads the rest of a list opened by a parenthesis or bracket, up to the
+// matching close, building it front to back. A dot before the last element
+// makes that element the cdr of the final pair.
+Item *readList(itemType close) {
+  Item *list=makeNull();
+  Item *last=NULL;//the final pair, which each new element is hung off
+  for(;;) {
+    Item *token=expectToken();
+    if(typeOf(token)==CLOSE_TYPE || typeOf(token)==CLOSEBRACKET_TYPE) {
+      if(typeOf(token)!=close) parser_error("mismatched close parenthesis");
+      return list;
+    }
+    if(typeOf(token)==DOT_TYPE) {
+      if(last==NULL) parser_error("dot at start of list");
+      last->c.cdr=readFrom(expectToken());
+      if(typeOf(expectToken())!=close) parser_error("expected one item after dot");
+      return list;
     }
-    stack=cons(token,stack);//add the token to the stack
-    tokens=cdr(tokens);//pop
+    Item *pair=cons(readFrom(token),makeNull());
+    if(last==NULL)
+      list=pair;
+    else
+      last->c.cdr=pair;
+    last=pair;
   }
-  if(nestingLevel!=0) parser_error("not enough close parentheses");
-  return reverse(stack);
-  //return (stack);
+}
+
+// reads the datum that starts with token
+Item *readFrom(Item *token) {
+  switch(typeOf(token)) {
+  case OPEN_TYPE:
+    return readList(CLOSE_TYPE);
+  case OPENBRACKET_TYPE:
+    return readList(CLOSEBRACKET_TYPE);
+  case OPENVECTOR_TYPE: {
+    //#(datum ...) is a vector literal, read as a list first
+    Item *elements=readList(CLOSE_TYPE);
+    Item *rest=elements;
+    while(typeOf(rest)==CONS_TYPE) rest=cdr(rest);
+    if(typeOf(rest)!=NULL_TYPE) parser_error("dot in vector");
+    return listToVector(elements);
+  }
+  case CLOSE_TYPE:
+  case CLOSEBRACKET_TYPE:
+    parser_error("too many close parentheses");
+    return NULL;
+  case DOT_TYPE:
+    parser_error("dot outside of list");
+    return NULL;
+  case SINGLEQUOTE_TYPE: {
+    //'datum is short for (quote datum)
+    Item *datum=readFrom(expectToken());
+    return cons(intern("quote"),cons(datum,makeNull()));
+  }
+  default:
+    return token;
+  }
+}
+
+// Reads one complete top-level datum from the input, going straight from
+// characters to the tree, and returns it, or NULL at the end of the input.
+Item *readDatum() {
+  Item *token=nextToken();
+  if(token==NULL) return NULL;
+  return readFrom(token);
 }
 
 //print the contents of a list
 void printList(Item *tree) {
-  while(tree->type==CONS_TYPE){
-    if(car(tree)->type==CONS_TYPE) {
-      printf("(");
+  while(typeOf(tree)==CONS_TYPE){
+    if(typeOf(car(tree))==CONS_TYPE) {
+      fprintf(context->output, "(");
       printList(car(tree));
-      printf(")");
+      fprintf(context->output, ")");
     } else {
       printToken(car(tree));
     }
-    if(cdr(tree)->type!=NULL_TYPE && car(tree)->type!=VOID_TYPE)
-      printf(" ");
+    if(typeOf(cdr(tree))!=NULL_TYPE && typeOf(car(tree))!=VOID_TYPE)
+      fprintf(context->output, " ");
     tree=cdr(tree);
   }
-  if(tree->type!=NULL_TYPE) {
+  if(typeOf(tree)!=NULL_TYPE) {
     //the list wasn't null terminated print a dot and the cdr
-    printf(". ");
+    fprintf(context->output, ". ");
     printToken(tree);
   }
 }
@@ -101,5 +157,5 @@ void printList(Item *tree) {
 // Scheme code; use parentheses to indicate subtrees.
 void printTree(Item *tree) {
   printList(tree);
-  printf("\n");
+  fprintf(context->output, "\n");
 }
@@ -3,9 +3,9 @@
 #ifndef PARSER_H
 #define PARSER_H
 
-// Takes a list of tokens from a Scheme program, and returns a pointer to a
-// parse tree representing that program.
-Item *parse(Item *tokens);
+// Reads one complete top-level datum from the input and returns its parse
+// tree, or NULL at the end of the input.
+Item *readDatum();
 
 
 // Prints the tree to the screen in a readable fashion.
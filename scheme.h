@@ -0,0 +1,50 @@
+#include <stdbool.h>
+
+#ifndef SCHEME_H
+#define SCHEME_H
+
+// The interface for embedding the interpreter in another program. Each
+// context is an interpreter of its own, with its own heap and global
+// environment. A program can make as many as it likes and use different ones
+// on different threads at once, but any one context on one thread at a time.
+typedef struct Context SchemeContext;
+
+// Makes a context whose global environment holds just the primitives. With
+// useVM, its top-level expressions are compiled and run on the VM rather than
+// by the tree-walking evaluator.
+SchemeContext *schemeCreate(bool useVM);
+
+// Evaluates each expression in source in turn, in the context's global
+// environment, as the interpreter does a program. Returns 0, or 1 if an error
+// stopped the evaluation. Unless output is NULL it is set to a string, which
+// the caller frees, holding what was written: the results, and the error
+// message if there was one.
+int schemeEval(SchemeContext *context, const char *source, char **output);
+
+// Evaluates the program in the file at path, as schemeEval does source.
+int schemeLoad(SchemeContext *context, const char *path, char **output);
+
+// Writes the context's global bindings, and everything they reach, to an
+// image file at path, and binds the variables saved in the image at path in
+// the context. Loading an image leaves the objects in it where the file is
+// mapped, so it takes time proportional to the image's size but does none of
+// the work of evaluating the program that made it. Both return as
+// schemeEval does, with any error message in output.
+int schemeSaveImage(SchemeContext *context, const char *path, char **output);
+int schemeLoadImage(SchemeContext *context, const char *path, char **output);
+
+// Records the context's global bindings as they stand, once a prelude has
+// been loaded, say. schemeRestore puts them back, undoing every define and
+// set! of a global since, and reclaims everything allocated since that is no
+// longer reachable. Objects that were already there keep any changes made to
+// them, such as by set-car! or hash-table-set!. They are also kept for good,
+// even once unreachable, so that schemeRestore takes time only for what was
+// allocated since, however big they are.
+void schemeSave(SchemeContext *context);
+void schemeRestore(SchemeContext *context);
+
+// Frees a context and everything in it, first waiting for any futures still
+// running in it.
+void schemeDestroy(SchemeContext *context);
+
+#endif
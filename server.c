@@ -0,0 +1,92 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "scheme.h"
+#include "server.h"
+
+// Between requests this thread is outside the server's context, which
+// schemeEval leaves on returning, so futures a request started go on
+// collecting while it waits for the next one here or in serveSocket.
+int serveStream(SchemeContext *server, FILE *in, FILE *out) {
+  char header[32];
+  while (fgets(header, sizeof(header), in) != NULL) {
+    char *end;
+    long length = strtol(header, &end, 10);
+    if (end == header || length < 0 || (*end != '\n' && *end != '\0')) {
+      fprintf(stderr, "Server error: malformed request header\n");
+      return 1;
+    }
+    char *source = malloc(length + 1);
+    if (source == NULL) {
+      printf("Allocation error: out of memory\n");
+      exit(1);
+    }
+    if (fread(source, 1, length, in) != (size_t)length) {
+      fprintf(stderr, "Server error: request cut short\n");
+      free(source);
+      return 1;
+    }
+    source[length] = '\0';
+
+    char *output;
+    int status = schemeEval(server, source, &output);
+    free(source);
+    if (output == NULL) {
+      printf("Allocation error: out of memory\n");
+      exit(1);
+    }
+    size_t size = strlen(output);
+    fprintf(out, "%s %zu\n", status == 0 ? "ok" : "error", size);
+    fwrite(output, 1, size, out);
+    fflush(out);
+    free(output);
+
+    // the reply is out, so the reset is not part of the request's latency
+    schemeRestore(server);
+  }
+  return 0;
+}
+
+int serveSocket(SchemeContext *server, const char *path) {
+  struct sockaddr_un address = {.sun_family = AF_UNIX};
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Server error: socket path too long\n");
+    return 1;
+  }
+  strcpy(address.sun_path, path);
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(path);
+  if (listener < 0
+      || bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0
+      || listen(listener, SOMAXCONN) != 0) {
+    perror("Server error");
+    return 1;
+  }
+  // a client that hangs up before its response is written ends only its
+  // connection
+  signal(SIGPIPE, SIG_IGN);
+
+  for (;;) {
+    int connection = accept(listener, NULL, NULL);
+    if (connection < 0) {
+      if (errno != EINTR)
+        perror("Server error");
+      continue;
+    }
+    FILE *in = fdopen(connection, "r");
+    FILE *out = fdopen(dup(connection), "w");
+    if (in != NULL && out != NULL)
+      serveStream(server, in, out);
+    if (in != NULL)
+      fclose(in);
+    else
+      close(connection);
+    if (out != NULL)
+      fclose(out);
+  }
+}
@@ -0,0 +1,25 @@
+#include <stdio.h>
+#include "scheme.h"
+
+#ifndef SERVER_H
+#define SERVER_H
+
+// A server evaluates each request in a context whose global bindings were
+// saved once its prelude was loaded, and restores them after replying, so
+// every request starts from the prelude alone.
+//
+// A request is its length in bytes, as a decimal number on a line of its
+// own, followed by that many bytes of source. The response is "ok" or
+// "error" and the length of the output on a line, followed by the output:
+// the results printed, and the error message if there was one.
+
+// Serves the requests read from in, writing the responses to out, until in
+// ends. Returns 0, or 1 if a request is malformed or cut short.
+int serveStream(SchemeContext *server, FILE *in, FILE *out);
+
+// Listens on a Unix-domain socket at path, serving each connection in turn as
+// serveStream does. Returns 1 if the socket cannot be set up; otherwise it
+// does not return.
+int serveSocket(SchemeContext *server, const char *path);
+
+#endif
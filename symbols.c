@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "symbols.h"
+
+// a symbol and its name, allocated together
+typedef struct Symbol {
+    Item item;
+    char name[];
+} Symbol;
+
+// open-addressed hash table of every symbol, never more than half full,
+// shared by every thread and guarded by symbolLock
+Symbol **symbolTable = NULL;
+size_t symbolCount = 0;
+size_t symbolCapacity = 0;
+pthread_mutex_t symbolLock = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a hash of the length bytes at name
+uint64_t hashName(char *name, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// returns the slot holding the name of the given length, or the empty slot
+// where it belongs
+size_t findSlot(Symbol **table, size_t capacity, char *name, size_t length) {
+    size_t slot = hashName(name, length) & (capacity - 1);
+    while(table[slot] != NULL && (strncmp(table[slot]->name, name, length)
+                                  || table[slot]->name[length] != '\0'))
+        slot = (slot + 1) & (capacity - 1);
+    return slot;
+}
+
+// doubles the size of the table, rehashing every symbol
+void growSymbolTable() {
+    size_t capacity = symbolCapacity ? 2 * symbolCapacity : 256;
+    Symbol **table = calloc(capacity, sizeof(Symbol *));
+    if(table == NULL) {
+        printf("Allocation error: out of memory\n");
+        exit(1);
+    }
+    for(size_t i = 0; i < symbolCapacity; i++)
+        if(symbolTable[i] != NULL)
+            table[findSlot(table, capacity, symbolTable[i]->name,
+                           strlen(symbolTable[i]->name))] = symbolTable[i];
+    free(symbolTable);
+    symbolTable = table;
+    symbolCapacity = capacity;
+}
+
+Item *internSpan(char *name, size_t length) {
+    pthread_mutex_lock(&symbolLock);
+    if(2 * (symbolCount + 1) > symbolCapacity) growSymbolTable();
+    size_t slot = findSlot(symbolTable, symbolCapacity, name, length);
+    if(symbolTable[slot] == NULL) {
+        Symbol *symbol = malloc(sizeof(Symbol) + length + 1);
+        if(symbol == NULL) {
+            printf("Allocation error: out of memory\n");
+            exit(1);
+        }
+        memcpy(symbol->name, name, length);
+        symbol->name[length] = '\0';
+        symbol->item.type = SYMBOL_TYPE;
+        symbol->item.s = symbol->name;
+        symbolTable[slot] = symbol;
+        symbolCount++;
+    }
+    Item *item = &symbolTable[slot]->item;
+    pthread_mutex_unlock(&symbolLock);
+    return item;
+}
+
+Item *intern(char *name) {
+    return internSpan(name, strlen(name));
+}
@@ -0,0 +1,17 @@
+#include <stddef.h>
+#include "item.h"
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+// Returns the symbol Item with the given name, creating it the first time the
+// name is seen. Every symbol with a given name is the same pointer, so symbols
+// can be compared with ==. Symbols live for the rest of the process and are
+// not part of any talloc heap, so every context shares them.
+Item *intern(char *name);
+
+// Same as intern, for a name given as the length bytes at name, which need
+// not be null-terminated.
+Item *internSpan(char *name, size_t length);
+
+#endif
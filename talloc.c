@@ -1,31 +1,991 @@
 #include "talloc.h"
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
-// initialize active list
-Item *head = NULL;
+// never collect while the heap is smaller than this
+#define MIN_COLLECT_BYTES (4 * 1024 * 1024)
 
-// takes in size, returns malloc(size), and adds result of malloc to active list
+// small objects are carved out of chunks of this size, aligned to it so the
+// chunk holding any address can be found by masking
+#define CHUNK_SIZE (256 * 1024)
+
+// cells come in power-of-two sizes from 16 up to 2048 bytes; anything larger
+// gets a malloc of its own
+#define MIN_CELL_SHIFT 4
+#define MAX_CELL_SHIFT 11
+#define CLASS_COUNT (MAX_CELL_SHIFT - MIN_CELL_SHIFT + 1)
+#define MAX_SMALL_SIZE ((size_t)1 << MAX_CELL_SHIFT)
+
+// bits of the per-cell metadata byte; the low two bits hold the objectKind
+#define KIND_MASK 3
+#define CELL_ALLOCATED 4
+#define CELL_MARKED 8
+
+// a chunk of cells of a single size. The metadata array, one byte per cell,
+// follows the header and the cells follow that.
+typedef struct Chunk {
+    struct Chunk *next;
+    // the chunk's dead cells after a sweep, until some thread takes them
+    struct Chunk *nextAvailable;
+    void *freeList;
+    size_t freeCells;
+    int shift;
+    char *cells;
+    char *end;
+    unsigned char meta[];
+} Chunk;
+
+// one thread's allocation state for one cell size: the free list of the chunk
+// it took dead cells from, then a bump pointer into a fresh chunk of its own.
+// Only the owning thread touches it, so the fast path takes no lock.
+typedef struct SizeClass {
+    void *freeList;
+    char *bump;
+    char *limit;
+} SizeClass;
+
+// objects too big for a cell, each given whole pages of its own with this
+// header in front, so that it can be write protected once sealed
+typedef struct LargeObject {
+    struct LargeObject *next;
+    size_t size;
+    objectKind kind;
+    bool marked;
+} LargeObject;
+
+// memory sealed by tseal, a chunk, a large object or a region, which is write
+// protected, with a byte for each page that is set once the page is written
+typedef struct Sealed {
+    char *start;
+    char *end;
+    unsigned char dirty[];
+} Sealed;
+
+// memory registered with tregion
+typedef struct Region {
+    void *base;
+    size_t size;
+} Region;
+
+// a thread that allocates from the heap. While it is stopped, for a
+// collection or because it is blocked elsewhere, its stack from stackTop to
+// stackBottom and the registers it saved are scanned for pointers.
+typedef struct Mutator {
+    struct Mutator *next;
+    pthread_t thread;
+    void *stackBottom;
+    void *stackTop;
+    jmp_buf registers;
+    bool stopped;
+    SizeClass classes[CLASS_COUNT];
+} Mutator;
+
+// A heap: its objects, and everything needed to collect them. Each thread
+// allocates from its current heap, which is the default heap until tuse
+// chooses another; threads with different heaps never touch each other's
+// objects and collect independently.
+struct Heap {
+    // the threads attached to the heap
+    Mutator *mutators;
+
+    // guards everything below that is shared between threads; changed is
+    // signalled when a thread stops or a collection finishes
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+
+    // set while a collection is under way. stopRequested is read without the
+    // lock on every allocation, so threads notice quickly that they should
+    // stop.
+    bool collecting;
+    volatile int stopRequested;
+
+    // chunks with dead cells that no thread has taken yet, per size class
+    Chunk *available[CLASS_COUNT];
+
+    // every chunk, plus a hash set of their addresses for recognising
+    // pointers
+    Chunk *chunks;
+    size_t chunkCount;
+    Chunk **chunkSet;
+    size_t chunkSetMask;
+
+    LargeObject *largeObjects;
+    size_t largeCount;
+
+    // bytes allocated since the last collection, and the amount that
+    // triggers the next one
+    size_t allocatedBytes;
+    size_t collectThreshold;
+
+    // addresses of pointer variables registered with troot
+    void ***roots;
+    int rootCount;
+    int rootCapacity;
+
+    // functions registered with tmarker, and what to pass them
+    void (**markers)(void *);
+    void **markerData;
+    int markerCount;
+
+    // memory registered with tregion, the first sealedRegions of it sealed
+    Region *regions;
+    int regionCount;
+    int sealedRegions;
+
+    // While sealed, the chunks and large objects that were there when the
+    // heap was sealed are kept out of the lists above, so collections neither
+    // trace nor sweep them, and every sealed range is listed in order of
+    // address for the fault handler to search. sealRequested asks the next
+    // collection to seal the heap.
+    bool sealed;
+    bool sealRequested;
+    Chunk *sealedChunks;
+    LargeObject *sealedLarge;
+    Sealed **sealedRanges;
+    size_t sealedCount;
+    size_t sealedCapacity;
+
+    // hash set of large objects, rebuilt for each collection
+    LargeObject **largeSet;
+    size_t largeSetMask;
+
+    // pointers to objects marked but not yet traced
+    void **markStack;
+    size_t markTop;
+    size_t markCapacity;
+};
+
+Heap defaultHeap = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .changed = PTHREAD_COND_INITIALIZER,
+    .collectThreshold = MIN_COLLECT_BYTES
+};
+
+// the calling thread's current heap, and the thread as a mutator of it, or
+// NULL if it has not attached to it
+_Thread_local Heap *heap = &defaultHeap;
+_Thread_local Mutator *self = NULL;
+
+// prints error message and exits without touching the heap
+void allocationError(char *message) {
+    printf("Allocation error: %s\n", message);
+    exit(1);
+}
+
+size_t pageSize() {
+    static size_t size = 0;
+    if(size == 0) size = sysconf(_SC_PAGESIZE);
+    return size;
+}
+
+// rounds size up to whole pages
+size_t wholePages(size_t size) {
+    return (size + pageSize() - 1) & ~(pageSize() - 1);
+}
+
+// the bytes a large object of the given size takes up, header included
+size_t largeFootprint(size_t size) {
+    return wholePages(sizeof(LargeObject) + size);
+}
+
+// scrambles every bit of an address into the low bits, which pick the slot;
+// chunks are CHUNK_SIZE-aligned, so their addresses differ only high up
+size_t hashPointer(void *pointer) {
+    uint64_t x = (uintptr_t)pointer;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+// rebuilds chunkSet from the chunk list
+void rebuildChunkSet() {
+    size_t capacity = 16;
+    while(capacity < 2 * heap->chunkCount) capacity *= 2;
+    free(heap->chunkSet);
+    heap->chunkSet = calloc(capacity, sizeof(Chunk *));
+    if(heap->chunkSet == NULL) allocationError("out of memory");
+    heap->chunkSetMask = capacity - 1;
+    for(Chunk *chunk = heap->chunks; chunk != NULL; chunk = chunk->next) {
+        size_t slot = hashPointer(chunk) & heap->chunkSetMask;
+        while(heap->chunkSet[slot] != NULL) slot = (slot + 1) & heap->chunkSetMask;
+        heap->chunkSet[slot] = chunk;
+    }
+}
+
+// gives the calling thread a fresh chunk of the size class to bump-allocate
+// from
+void newChunk(int class) {
+    int shift = class + MIN_CELL_SHIFT;
+    Chunk *chunk = aligned_alloc(CHUNK_SIZE, CHUNK_SIZE);
+    if(chunk == NULL) allocationError("out of memory");
+    size_t metaBytes = CHUNK_SIZE >> shift;
+    size_t cellSize = (size_t)1 << shift;
+    uintptr_t cells = (uintptr_t)chunk->meta + metaBytes;
+    cells = (cells + cellSize - 1) & ~(uintptr_t)(cellSize - 1);
+    chunk->shift = shift;
+    chunk->cells = (char *)cells;
+    chunk->end = (char *)chunk + CHUNK_SIZE;
+    memset(chunk->meta, 0, metaBytes);
+    chunk->next = heap->chunks;
+    heap->chunks = chunk;
+    heap->chunkCount++;
+    if(2 * heap->chunkCount > heap->chunkSetMask + 1) {
+        rebuildChunkSet();
+    } else {
+        size_t slot = hashPointer(chunk) & heap->chunkSetMask;
+        while(heap->chunkSet[slot] != NULL) slot = (slot + 1) & heap->chunkSetMask;
+        heap->chunkSet[slot] = chunk;
+    }
+    chunk->freeList = NULL;
+    chunk->freeCells = 0;
+    self->classes[class].bump = chunk->cells;
+    self->classes[class].limit = chunk->end;
+    heap->allocatedBytes += CHUNK_SIZE;
+}
+
+// returns the size class whose cells fit size bytes
+int classFor(size_t size) {
+    if(size <= ((size_t)1 << MIN_CELL_SHIFT)) return 0;
+#ifdef __GNUC__
+    return (int)(8 * sizeof(long) - __builtin_clzl(size - 1)) - MIN_CELL_SHIFT;
+#else
+    int class = 0;
+    while(((size_t)1 << (class + MIN_CELL_SHIFT)) < size) class++;
+    return class;
+#endif
+}
+
+void collectLocked();
+
+void *allocateLarge(size_t size, objectKind kind) {
+    pthread_mutex_lock(&heap->lock);
+    if(heap->collecting || (self->stackBottom != NULL && heap->allocatedBytes > heap->collectThreshold))
+        collectLocked();
+    LargeObject *new = aligned_alloc(pageSize(), largeFootprint(size));
+    if(new == NULL) allocationError("out of memory");
+    if(kind != RAW_OBJECT) memset(new + 1, 0, size);
+    new->next = heap->largeObjects;
+    new->size = size;
+    new->kind = kind;
+    new->marked = false;
+    heap->largeObjects = new;
+    heap->largeCount++;
+    heap->allocatedBytes += largeFootprint(size);
+    pthread_mutex_unlock(&heap->lock);
+    return new + 1;
+}
+
+// registers the calling thread as a mutator, if it is not one yet
+void attachThread() {
+    if(self != NULL) return;
+    Mutator *mutator = calloc(1, sizeof(Mutator));
+    if(mutator == NULL) allocationError("out of memory");
+    pthread_mutex_lock(&heap->lock);
+    mutator->thread = pthread_self();
+    mutator->next = heap->mutators;
+    heap->mutators = mutator;
+    self = mutator;
+    pthread_mutex_unlock(&heap->lock);
+}
+
+// gives the calling thread more cells of the size class to allocate from:
+// a chunk's worth of dead cells if there are any, a fresh chunk otherwise.
+// This is where collections are started.
+void takeCells(int class) {
+    pthread_mutex_lock(&heap->lock);
+    if(heap->collecting || (self->stackBottom != NULL && heap->allocatedBytes > heap->collectThreshold))
+        collectLocked();
+    Chunk *chunk = heap->available[class];
+    if(chunk != NULL) {
+        heap->available[class] = chunk->nextAvailable;
+        self->classes[class].freeList = chunk->freeList;
+        heap->allocatedBytes += chunk->freeCells << chunk->shift;
+        chunk->freeList = NULL;
+        chunk->freeCells = 0;
+    } else {
+        newChunk(class);
+    }
+    pthread_mutex_unlock(&heap->lock);
+}
+
+void safepoint();
+
+// allocates a new object of the given kind from the heap
+void *allocate(size_t size, objectKind kind) {
+    if(self == NULL) attachThread();
+    if(heap->stopRequested) safepoint();
+    if(size > MAX_SMALL_SIZE)
+        return allocateLarge(size, kind);
+
+    int class = classFor(size);
+    SizeClass *sizeClass = &self->classes[class];
+    size_t cellSize = (size_t)1 << (class + MIN_CELL_SHIFT);
+    if(sizeClass->freeList == NULL && sizeClass->bump == sizeClass->limit)
+        takeCells(class);
+    char *cell = sizeClass->freeList;
+    if(cell != NULL) {
+        sizeClass->freeList = *(void **)cell;
+    } else {
+        cell = sizeClass->bump;
+        sizeClass->bump += cellSize;
+    }
+    Chunk *chunk = (Chunk *)((uintptr_t)cell & ~(uintptr_t)(CHUNK_SIZE - 1));
+    chunk->meta[(cell - chunk->cells) >> chunk->shift] = CELL_ALLOCATED | kind;
+    if(kind != RAW_OBJECT) memset(cell, 0, cellSize);
+    return cell;
+}
+
+// takes in size, returns raw memory of that size from the heap
 void *talloc(size_t size) {
-    Item *new = malloc(sizeof(Item));
-    new->type=CONS_TYPE;
-    new->c = (struct ConsCell) {malloc(size), head};
-    head = new;
-    return head->c.car;
+    return allocate(size, RAW_OBJECT);
 }
 
-// free all items in active list
-void tfree() {
-    while(head != NULL) {
-        Item *to_free = head;
-        head = head->c.cdr;
-        free(to_free->c.car);
+// takes in size and kind, returns zeroed memory the collector can trace
+void *tallocObject(size_t size, objectKind kind) {
+    return allocate(size, kind);
+}
+
+void tinit(void *bottom) {
+    attachThread();
+    pthread_mutex_lock(&heap->lock);
+    self->stackBottom = bottom;
+    pthread_mutex_unlock(&heap->lock);
+}
+
+void troot(void *root) {
+    pthread_mutex_lock(&heap->lock);
+    if(heap->rootCount == heap->rootCapacity) {
+        heap->rootCapacity = heap->rootCapacity ? 2 * heap->rootCapacity : 16;
+        heap->roots = realloc(heap->roots, heap->rootCapacity * sizeof(void **));
+        if(heap->roots == NULL) allocationError("out of memory");
+    }
+    heap->roots[heap->rootCount++] = root;
+    pthread_mutex_unlock(&heap->lock);
+}
+
+void tdetach() {
+    if(self == NULL) return;
+    pthread_mutex_lock(&heap->lock);
+    Mutator **link = &heap->mutators;
+    while(*link != self) link = &(*link)->next;
+    *link = self->next;
+    pthread_cond_broadcast(&heap->changed);
+    pthread_mutex_unlock(&heap->lock);
+    free(self);
+    self = NULL;
+}
+
+void tmarker(void (*marker)(void *), void *data) {
+    pthread_mutex_lock(&heap->lock);
+    heap->markers = realloc(heap->markers, (heap->markerCount + 1) * sizeof(*heap->markers));
+    heap->markerData = realloc(heap->markerData, (heap->markerCount + 1) * sizeof(void *));
+    if(heap->markers == NULL || heap->markerData == NULL) allocationError("out of memory");
+    heap->markers[heap->markerCount] = marker;
+    heap->markerData[heap->markerCount++] = data;
+    pthread_mutex_unlock(&heap->lock);
+}
+
+Heap *theapCreate() {
+    Heap *new = calloc(1, sizeof(Heap));
+    if(new == NULL) allocationError("out of memory");
+    pthread_mutex_init(&new->lock, NULL);
+    pthread_cond_init(&new->changed, NULL);
+    new->collectThreshold = MIN_COLLECT_BYTES;
+    return new;
+}
+
+Heap *tuse(Heap *new) {
+    Heap *old = heap;
+    heap = new;
+    self = NULL;
+    pthread_mutex_lock(&heap->lock);
+    for(Mutator *mutator = heap->mutators; mutator != NULL; mutator = mutator->next)
+        if(pthread_equal(mutator->thread, pthread_self())) self = mutator;
+    pthread_mutex_unlock(&heap->lock);
+    return old;
+}
+
+// fills largeSet with the address of every large object's payload
+void buildLargeSet() {
+    size_t capacity = 16;
+    while(capacity < 2 * heap->largeCount) capacity *= 2;
+    heap->largeSet = calloc(capacity, sizeof(LargeObject *));
+    if(heap->largeSet == NULL) allocationError("out of memory");
+    heap->largeSetMask = capacity - 1;
+    for(LargeObject *object = heap->largeObjects; object != NULL; object = object->next) {
+        size_t slot = hashPointer(object + 1) & heap->largeSetMask;
+        while(heap->largeSet[slot] != NULL) slot = (slot + 1) & heap->largeSetMask;
+        heap->largeSet[slot] = object;
+    }
+}
+
+// returns the chunk containing pointer, or NULL if it is not in one
+Chunk *findChunk(void *pointer) {
+    Chunk *candidate = (Chunk *)((uintptr_t)pointer & ~(uintptr_t)(CHUNK_SIZE - 1));
+    size_t slot = hashPointer(candidate) & heap->chunkSetMask;
+    while(heap->chunkSet[slot] != NULL) {
+        if(heap->chunkSet[slot] == candidate) return candidate;
+        slot = (slot + 1) & heap->chunkSetMask;
+    }
+    return NULL;
+}
+
+// returns the large object whose payload starts at pointer, or NULL
+LargeObject *findLarge(void *pointer) {
+    size_t slot = hashPointer(pointer) & heap->largeSetMask;
+    while(heap->largeSet[slot] != NULL) {
+        if((void *)(heap->largeSet[slot] + 1) == pointer) return heap->largeSet[slot];
+        slot = (slot + 1) & heap->largeSetMask;
+    }
+    return NULL;
+}
+
+// queues an object to be traced
+void pushMark(void *object) {
+    if(heap->markTop == heap->markCapacity) {
+        heap->markCapacity = heap->markCapacity ? 2 * heap->markCapacity : 1024;
+        heap->markStack = realloc(heap->markStack, heap->markCapacity * sizeof(void *));
+        if(heap->markStack == NULL) allocationError("out of memory");
+    }
+    heap->markStack[heap->markTop++] = object;
+}
+
+// marks the object pointer points into, if any, and queues it to be traced.
+// Returns whether there is one; sealed objects do not count, being live
+// already.
+bool markPointer(void *pointer) {
+    if(pointer == NULL) return false;
+    if(heap->chunkSet != NULL) {
+        Chunk *chunk = findChunk(pointer);
+        if(chunk != NULL) {
+            if((char *)pointer < chunk->cells) return false;
+            size_t index = ((char *)pointer - chunk->cells) >> chunk->shift;
+            unsigned char meta = chunk->meta[index];
+            if(!(meta & CELL_ALLOCATED)) return false;
+            if(meta & CELL_MARKED) return true;
+            chunk->meta[index] = meta | CELL_MARKED;
+            if((meta & KIND_MASK) != RAW_OBJECT)
+                pushMark(chunk->cells + (index << chunk->shift));
+            return true;
+        }
+    }
+    LargeObject *object = findLarge(pointer);
+    if(object == NULL) return false;
+    if(object->marked) return true;
+    object->marked = true;
+    if(object->kind != RAW_OBJECT) pushMark(object + 1);
+    return true;
+}
+
+// returns the kind of a marked object, and sets size to its size
+objectKind kindOf(void *object, size_t *size) {
+    Chunk *chunk = heap->chunkSet != NULL ? findChunk(object) : NULL;
+    if(chunk != NULL) {
+        *size = (size_t)1 << chunk->shift;
+        return chunk->meta[((char *)object - chunk->cells) >> chunk->shift] & KIND_MASK;
+    }
+    *size = ((LargeObject *)object - 1)->size;
+    return ((LargeObject *)object - 1)->kind;
+}
+
+// marks a field that holds an Item; immediates point nowhere
+void markItem(Item *item) {
+    if(isHeapItem(item)) markPointer(item);
+}
+
+// marks everything an Item points to
+void traceItem(Item *item) {
+    switch(item->type) {
+    case CONS_TYPE:
+        markItem(item->c.car);
+        markItem(item->c.cdr);
+        break;
+    case CLOSURE_TYPE:
+        markItem(item->cl.paramNames);
+        markPointer(item->cl.functionCode);
+        markPointer(item->cl.frame);
+        break;
+    case STR_TYPE:
+    case SYMBOL_TYPE:
+    case OPEN_TYPE:
+    case CLOSE_TYPE:
+    case OPENBRACKET_TYPE:
+    case CLOSEBRACKET_TYPE:
+    case DOT_TYPE:
+    case SINGLEQUOTE_TYPE:
+        markPointer(item->s);
+        break;
+    case PTR_TYPE:
+        markPointer(item->p);
+        break;
+    case SYNTAX_TYPE:
+        markItem(item->sx.args);
+        markItem(item->sx.cache);
+        break;
+    case LOCAL_TYPE:
+        markPointer(item->la.name);
+        break;
+    case CODE_TYPE:
+        markPointer(item->cd.ops);
+        markPointer(item->cd.constants);
+        break;
+    case BIGNUM_TYPE:
+        markPointer(item->bn.digits);
+        break;
+    case VECTOR_TYPE:
+        markPointer(item->vec.elements);
+        break;
+    case HASHTABLE_TYPE:
+        markPointer(item->ht.slots);
+        break;
+    case FUTURE_TYPE:
+        markItem(item->fu.function);
+        markItem(item->fu.value);
+        break;
+    default:
+        break;
+    }
+}
+
+// traces queued objects until nothing reachable is left unmarked
+void drainMarkStack() {
+    while(heap->markTop > 0) {
+        void *object = heap->markStack[--heap->markTop];
+        size_t size;
+        objectKind kind = kindOf(object, &size);
+        if(kind == ITEM_OBJECT) {
+            traceItem(object);
+        } else if(kind == FRAME_OBJECT) {
+            Frame *frame = object;
+            markItem(frame->bindings);
+            markPointer(frame->parent);
+            for(int i = 0; i < frame->size; i++)
+                markItem(frame->slots[i]);
+        } else if(kind == POINTERS_OBJECT) {
+            void **pointers = object;
+            for(size_t i = 0; i < size / sizeof(void *); i++)
+                markItem(pointers[i]);
+        }
+    }
+}
+
+// treats every aligned word between the two addresses as a possible pointer
+void scanRange(void *from, void *to) {
+    if(from > to) {
+        void *swap = from;
+        from = to;
+        to = swap;
+    }
+    uintptr_t word = ((uintptr_t)from + sizeof(void *) - 1) & ~(uintptr_t)(sizeof(void *) - 1);
+    for(; word + sizeof(void *) <= (uintptr_t)to; word += sizeof(void *))
+        markPointer(*(void **)word);
+}
+
+void tmark(void *pointer) {
+    markPointer(pointer);
+}
+
+// records where the calling thread's stack ends and what its registers hold,
+// so a collection can scan them, and marks the thread stopped. Kept out of
+// line so that its frame lies beyond everything its callers keep on the stack.
+__attribute__((noinline)) void stopHere() {
+#ifdef __GNUC__
+    __builtin_unwind_init();
+#endif
+    setjmp(self->registers);
+    void *top = &top;
+    self->stackTop = top;
+    self->stopped = true;
+}
+
+// with the heap lock held, stops the calling thread until any collection
+// under way has finished
+void park() {
+    stopHere();
+    pthread_cond_broadcast(&heap->changed);
+    while(heap->collecting) pthread_cond_wait(&heap->changed, &heap->lock);
+    self->stopped = false;
+}
+
+// called on allocation when another thread wants to collect
+void safepoint() {
+    pthread_mutex_lock(&heap->lock);
+    park();
+    pthread_mutex_unlock(&heap->lock);
+}
+
+void tpark() {
+    if(self == NULL) return;
+    pthread_mutex_lock(&heap->lock);
+    stopHere();
+    pthread_cond_broadcast(&heap->changed);
+    pthread_mutex_unlock(&heap->lock);
+}
+
+void tunpark() {
+    if(self == NULL) return;
+    pthread_mutex_lock(&heap->lock);
+    while(heap->collecting) pthread_cond_wait(&heap->changed, &heap->lock);
+    self->stopped = false;
+    pthread_mutex_unlock(&heap->lock);
+}
+
+// returns true once every other thread that allocates is stopped
+bool othersStopped() {
+    for(Mutator *mutator = heap->mutators; mutator != NULL; mutator = mutator->next)
+        if(mutator != self && mutator->stackBottom != NULL && !mutator->stopped)
+            return false;
+    return true;
+}
+
+// frees every unmarked object and clears the marks on the rest. Dead cells are
+// threaded onto the free lists, and chunks left with no live cells at all are
+// handed back to the system.
+void sweep() {
+    size_t liveBytes = 0;
+    // while sealed, each collection tends to empty the chunks allocated since
+    // the last, which the next evaluation needs again, so up to a collection's
+    // worth of them are kept
+    size_t keptBytes = 0;
+    for(Mutator *mutator = heap->mutators; mutator != NULL; mutator = mutator->next)
+        memset(mutator->classes, 0, sizeof(mutator->classes));
+    memset(heap->available, 0, sizeof(heap->available));
+
+    Chunk **link = &heap->chunks;
+    while(*link != NULL) {
+        Chunk *chunk = *link;
+        int class = chunk->shift - MIN_CELL_SHIFT;
+        size_t cellSize = (size_t)1 << chunk->shift;
+        size_t cellCount = (chunk->end - chunk->cells) >> chunk->shift;
+        void *freeList = NULL;
+        size_t liveCells = 0;
+        for(size_t index = 0; index < cellCount; index++) {
+            unsigned char meta = chunk->meta[index];
+            if(meta & CELL_MARKED) {
+                chunk->meta[index] = meta & ~CELL_MARKED;
+                liveCells++;
+            } else {
+                void *cell = chunk->cells + (index << chunk->shift);
+                chunk->meta[index] = 0;
+                *(void **)cell = freeList;
+                freeList = cell;
+            }
+        }
+        if(liveCells == 0 && !(heap->sealed && keptBytes < MIN_COLLECT_BYTES)) {
+            *link = chunk->next;
+            heap->chunkCount--;
+            free(chunk);
+            continue;
+        }
+        if(liveCells == 0) keptBytes += CHUNK_SIZE;
+        chunk->freeList = freeList;
+        chunk->freeCells = cellCount - liveCells;
+        if(chunk->freeCells > 0) {
+            chunk->nextAvailable = heap->available[class];
+            heap->available[class] = chunk;
+        }
+        liveBytes += liveCells * cellSize;
+        link = &chunk->next;
+    }
+    rebuildChunkSet();
+
+    LargeObject **largeLink = &heap->largeObjects;
+    while(*largeLink != NULL) {
+        LargeObject *object = *largeLink;
+        if(object->marked) {
+            object->marked = false;
+            liveBytes += largeFootprint(object->size);
+            largeLink = &object->next;
+        } else {
+            *largeLink = object->next;
+            heap->largeCount--;
+            free(object);
+        }
+    }
+
+    heap->allocatedBytes = 0;
+    heap->collectThreshold = liveBytes > MIN_COLLECT_BYTES ? liveBytes : MIN_COLLECT_BYTES;
+}
+
+// returns the sealed range holding address, or NULL. The ranges only change
+// while every thread that might write to them is stopped.
+Sealed *findSealed(void *address) {
+    size_t low = 0, high = heap->sealedCount;
+    while(low < high) {
+        size_t middle = (low + high) / 2;
+        Sealed *range = heap->sealedRanges[middle];
+        if((char *)address < range->start) high = middle;
+        else if((char *)address >= range->end) low = middle + 1;
+        else return range;
+    }
+    return NULL;
+}
+
+// The first write to a sealed page since the last collection: records that
+// the page may now point to objects allocated since the heap was sealed, and
+// lets the write go ahead. Any other fault is left to crash the program, as
+// it would have.
+void sealedWrite(int signal, siginfo_t *info, void *unused) {
+    Sealed *range = heap->sealed ? findSealed(info->si_addr) : NULL;
+    if(range == NULL) {
+        sigaction(signal, &(struct sigaction){.sa_handler = SIG_DFL}, NULL);
+        return;
+    }
+    size_t page = ((char *)info->si_addr - range->start) / pageSize();
+    range->dirty[page] = 1;
+    mprotect(range->start + page * pageSize(), pageSize(), PROT_READ | PROT_WRITE);
+}
+
+void installSealedWrite() {
+    struct sigaction action = {.sa_sigaction = sealedWrite, .sa_flags = SA_SIGINFO | SA_RESTART};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, NULL);
+}
+
+// write protects the pages from start to end, which start at a page boundary,
+// and lists them among the sealed ranges in order of address
+void addSealed(void *start, void *end) {
+    size_t pages = wholePages((char *)end - (char *)start) / pageSize();
+    Sealed *range = calloc(1, sizeof(Sealed) + pages);
+    if(range == NULL) allocationError("out of memory");
+    range->start = start;
+    range->end = (char *)start + pages * pageSize();
+    if(heap->sealedCount == heap->sealedCapacity) {
+        heap->sealedCapacity = heap->sealedCapacity ? 2 * heap->sealedCapacity : 64;
+        heap->sealedRanges = realloc(heap->sealedRanges, heap->sealedCapacity * sizeof(Sealed *));
+        if(heap->sealedRanges == NULL) allocationError("out of memory");
+    }
+    size_t index = heap->sealedCount++;
+    while(index > 0 && heap->sealedRanges[index - 1]->start > range->start) {
+        heap->sealedRanges[index] = heap->sealedRanges[index - 1];
+        index--;
+    }
+    heap->sealedRanges[index] = range;
+    mprotect(range->start, range->end - range->start, PROT_READ);
+}
+
+// with every other thread stopped and the heap just swept, treats everything
+// in it as live from now on: its chunks and large objects are set aside and
+// they and the regions write protected. The threads have no cells to
+// allocate from, so they start on fresh chunks.
+void seal() {
+    static pthread_once_t installed = PTHREAD_ONCE_INIT;
+    pthread_once(&installed, installSealedWrite);
+    for(Chunk *chunk = heap->chunks; chunk != NULL; chunk = chunk->next)
+        addSealed(chunk, (char *)chunk + CHUNK_SIZE);
+    for(LargeObject *object = heap->largeObjects; object != NULL; object = object->next)
+        addSealed(object, (char *)object + largeFootprint(object->size));
+    for(int i = 0; i < heap->regionCount; i++) {
+        char *base = heap->regions[i].base;
+        char *start = (char *)((uintptr_t)base & ~(pageSize() - 1));
+        addSealed(start, base + heap->regions[i].size);
+    }
+    heap->sealedRegions = heap->regionCount;
+    heap->sealedChunks = heap->chunks;
+    heap->chunks = NULL;
+    heap->chunkCount = 0;
+    rebuildChunkSet();
+    heap->sealedLarge = heap->largeObjects;
+    heap->largeObjects = NULL;
+    heap->largeCount = 0;
+    memset(heap->available, 0, sizeof(heap->available));
+    heap->allocatedBytes = 0;
+    heap->collectThreshold = MIN_COLLECT_BYTES;
+    heap->sealed = true;
+}
+
+// lifts the protection from a heap's sealed ranges and returns the sealed
+// chunks and large objects to it, leaving its chunkSet to be rebuilt
+void releaseSealed(Heap *heap) {
+    if(!heap->sealed) return;
+    for(size_t i = 0; i < heap->sealedCount; i++) {
+        Sealed *range = heap->sealedRanges[i];
+        mprotect(range->start, range->end - range->start, PROT_READ | PROT_WRITE);
+        free(range);
+    }
+    free(heap->sealedRanges);
+    heap->sealedRanges = NULL;
+    heap->sealedCount = heap->sealedCapacity = 0;
+    heap->sealedRegions = 0;
+    while(heap->sealedChunks != NULL) {
+        Chunk *chunk = heap->sealedChunks;
+        heap->sealedChunks = chunk->next;
+        chunk->next = heap->chunks;
+        heap->chunks = chunk;
+        heap->chunkCount++;
+    }
+    while(heap->sealedLarge != NULL) {
+        LargeObject *object = heap->sealedLarge;
+        heap->sealedLarge = object->next;
+        object->next = heap->largeObjects;
+        heap->largeObjects = object;
+        heap->largeCount++;
+    }
+    heap->sealed = false;
+}
+
+void unseal() {
+    releaseSealed(heap);
+    rebuildChunkSet();
+}
+
+// marks whatever the sealed pages written since the last collection point
+// to, and protects again those that no longer point to anything unsealed
+void scanSealed() {
+    for(size_t i = 0; i < heap->sealedCount; i++) {
+        Sealed *range = heap->sealedRanges[i];
+        size_t pages = (range->end - range->start) / pageSize();
+        for(size_t page = 0; page < pages; page++) {
+            if(!range->dirty[page]) continue;
+            void **words = (void **)(range->start + page * pageSize());
+            bool pointsOut = false;
+            for(size_t word = 0; word < pageSize() / sizeof(void *); word++)
+                if(markPointer(words[word])) pointsOut = true;
+            if(!pointsOut) {
+                range->dirty[page] = 0;
+                mprotect(words, pageSize(), PROT_READ);
+            }
+        }
+    }
+}
+
+// with the heap lock held, stops every other thread at its next allocation
+// or wherever it is parked, marks everything reachable from the roots and the
+// threads' stacks, and frees everything else. If another thread is already
+// collecting, waits for it instead.
+void collectLocked() {
+    if(heap->collecting) {
+        park();
+        return;
+    }
+    heap->collecting = true;
+    heap->stopRequested = 1;
+    stopHere();
+    while(!othersStopped()) pthread_cond_wait(&heap->changed, &heap->lock);
+
+    // sealing starts over from a collection of everything
+    bool sealing = heap->sealRequested;
+    if(sealing) unseal();
+    buildLargeSet();
+    for(int i = 0; i < heap->rootCount; i++)
+        markPointer(*heap->roots[i]);
+    for(Mutator *mutator = heap->mutators; mutator != NULL; mutator = mutator->next) {
+        if(mutator->stackBottom == NULL) continue;
+        scanRange(mutator->stackTop, mutator->stackBottom);
+        scanRange(&mutator->registers, (char *)&mutator->registers + sizeof(jmp_buf));
+    }
+    for(int i = 0; i < heap->markerCount; i++)
+        heap->markers[i](heap->markerData[i]);
+    if(heap->sealed) scanSealed();
+    for(int i = heap->sealedRegions; i < heap->regionCount; i++)
+        scanRange(heap->regions[i].base, (char *)heap->regions[i].base + heap->regions[i].size);
+    drainMarkStack();
+    free(heap->largeSet);
+    heap->largeSet = NULL;
+    heap->largeSetMask = 0;
+    sweep();
+    if(sealing) {
+        seal();
+        heap->sealRequested = false;
+    }
+
+    self->stopped = false;
+    heap->stopRequested = 0;
+    heap->collecting = false;
+    pthread_cond_broadcast(&heap->changed);
+}
+
+// mark everything reachable from the registered roots and the threads' stacks,
+// then free everything else
+void tcollect() {
+    if(self == NULL || self->stackBottom == NULL) return;
+    pthread_mutex_lock(&heap->lock);
+    collectLocked();
+    pthread_mutex_unlock(&heap->lock);
+}
+
+void tregion(void *base, size_t size) {
+    pthread_mutex_lock(&heap->lock);
+    heap->regions = realloc(heap->regions, (heap->regionCount + 1) * sizeof(Region));
+    if(heap->regions == NULL) allocationError("out of memory");
+    // the sealed ranges only change while other threads are stopped, so a
+    // region added to a sealed heap is scanned whole until it is sealed again
+    heap->regions[heap->regionCount++] = (Region){base, size};
+    pthread_mutex_unlock(&heap->lock);
+}
+
+void tseal() {
+    if(self == NULL || self->stackBottom == NULL) return;
+    pthread_mutex_lock(&heap->lock);
+    heap->sealRequested = true;
+    while(heap->sealRequested) collectLocked();
+    pthread_mutex_unlock(&heap->lock);
+}
+
+// free every chunk and large object of a heap; takes time proportional to
+// their number, not to the number of objects allocated
+void freeObjects(Heap *heap) {
+    releaseSealed(heap);
+    while(heap->chunks != NULL) {
+        Chunk *to_free = heap->chunks;
+        heap->chunks = heap->chunks->next;
+        free(to_free);
+    }
+    heap->chunkCount = 0;
+    free(heap->chunkSet);
+    heap->chunkSet = NULL;
+    heap->chunkSetMask = 0;
+    while(heap->largeObjects != NULL) {
+        LargeObject *to_free = heap->largeObjects;
+        heap->largeObjects = heap->largeObjects->next;
         free(to_free);
     }
+    heap->largeCount = 0;
+    for(Mutator *mutator = heap->mutators; mutator != NULL; mutator = mutator->next)
+        memset(mutator->classes, 0, sizeof(mutator->classes));
+    memset(heap->available, 0, sizeof(heap->available));
+    heap->allocatedBytes = 0;
+    heap->collectThreshold = MIN_COLLECT_BYTES;
+    free(heap->markStack);
+    heap->markStack = NULL;
+    heap->markTop = heap->markCapacity = 0;
+}
+
+void tfree() {
+    freeObjects(heap);
+}
+
+void theapDestroy(Heap *old) {
+    freeObjects(old);
+    while(old->mutators != NULL) {
+        Mutator *mutator = old->mutators;
+        old->mutators = mutator->next;
+        free(mutator);
+    }
+    free(old->roots);
+    free(old->regions);
+    free(old->markers);
+    free(old->markerData);
+    pthread_mutex_destroy(&old->lock);
+    pthread_cond_destroy(&old->changed);
+    free(old);
 }
 
-// free and exit with status "status"
+// free and exit with status "status". If other threads share the heap they
+// may still be using it, so then it is left to the system to reclaim.
 void texit(int status) {
-    tfree();
+    if(heap->mutators == NULL || heap->mutators->next == NULL) tfree();
+    else fflush(stdout);
     exit(status);
 }
-
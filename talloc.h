@@ -4,11 +4,80 @@
 #ifndef TALLOC_H
 #define TALLOC_H
 
+// The kinds of object talloc hands out. The garbage collector uses the kind to
+// find the pointers held inside an object.
+typedef enum {
+    RAW_OBJECT,   // plain bytes (strings, buffers); never looked inside
+    ITEM_OBJECT,  // an Item, traced according to its type
+    FRAME_OBJECT, // a Frame, traced through its bindings, parent and slots
+    POINTERS_OBJECT // an array of pointers to heap objects, all traced
+} objectKind;
+
 // Replacement for malloc that stores the pointers allocated so they can be freed easily later.
+// The memory is raw: anything it points to is not kept alive by it.
 void *talloc(size_t size);
 
-// Free all pointers allocated by talloc, as well as whatever memory you
-// allocated in lists to hold those pointers.
+// Allocate zeroed memory for an object of the given kind. Objects that are no
+// longer reachable from a root are reclaimed by the garbage collector.
+void *tallocObject(size_t size, objectKind kind);
+
+// A heap of objects with a collector of its own. Every thread has a current
+// heap, which everything below works on; it is a default heap shared by the
+// whole process until tuse picks another.
+typedef struct Heap Heap;
+
+// Make an empty heap, and free one along with every object in it. No thread
+// may be attached to a heap that is destroyed.
+Heap *theapCreate();
+void theapDestroy(Heap *heap);
+
+// Make heap the calling thread's current heap, returning the one it replaces.
+Heap *tuse(Heap *heap);
+
+// Attach the calling thread to its current heap, recording the base of its C
+// stack. Every thread that allocates must call this first; the stack between
+// the point where the thread stopped for a collection and this address is
+// scanned for pointers into the heap.
+void tinit(void *stackBottom);
+
+// Detach the calling thread from its current heap, which stops waiting for it
+// and scanning its stack. The thread must not touch the heap's objects again
+// until it attaches once more.
+void tdetach();
+
+// Register the address of a pointer variable that lives outside the C stack
+// (a global, for example) as a root for the garbage collector.
+void troot(void *root);
+
+// Register a function the collector calls with data while marking, to mark
+// pointers kept outside the heap by calling tmark on each of them.
+void tmarker(void (*marker)(void *), void *data);
+void tmark(void *pointer);
+
+// Register memory outside the heap, such as a mapped file, any word of which
+// may point into the heap. It must last as long as the heap.
+void tregion(void *base, size_t size);
+
+// Bracket code where the calling thread blocks waiting for another thread.
+// Collections can go ahead in between, so the thread must not allocate or
+// write heap pointers there; tunpark waits for any collection to finish.
+void tpark();
+void tunpark();
+
+// Mark everything reachable from the roots and free everything else. Other
+// threads are stopped at their next allocation while this happens.
+void tcollect();
+
+// Collect, then keep everything left for good. Later collections trace and
+// sweep only what is allocated after, so they take no longer however much
+// was sealed. To find what sealed objects are made to point to, the sealed
+// memory and regions are write protected, and the first write to each page
+// after a collection takes a fault. Sealing again first unseals, so the next
+// collection covers everything.
+void tseal();
+
+// Free all pointers allocated by talloc from the current heap, as well as
+// whatever memory you allocated in lists to hold those pointers.
 void tfree();
 
 // Replacement for the C function "exit", that consists of two lines: it calls
@@ -16,4 +85,3 @@ void tfree();
 void texit(int status);
 
 #endif
-
@@ -1,16 +1,181 @@
 #include <stdio.h>
 #include <ctype.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "tokenizer.h"
 #include "linkedlist.h"
+#include "bignum.h"
 #include "talloc.h"
+#include "symbols.h"
 #include "stdbool.h"
+#include "context.h"
 
-#define TOKEN_LENGTH_LIMIT 300
+// how much to read at a time when the input cannot be mapped
+#define READ_SIZE (64 * 1024)
 
-//prints syntax error message then exits, freeing all memory used
+// The input being tokenized. A regular file is mapped whole, so tokens are
+// read straight out of it, and unmapped once the input is freed.
+// Anything else (a pipe or a terminal) is read a block at a time into a
+// buffer that keeps only the bytes from tokenStart, the start of the token
+// being read, onwards. A string given to openString is copied into the buffer
+// as if it had all been read already.
+typedef struct Input {
+  char *text;
+  size_t length;
+  size_t position;
+  size_t capacity;
+  size_t tokenStart;
+  int file;
+  // the file's path, or NULL for stdin or a string
+  char *path;
+  bool mapped;
+  bool ended;
+  // terminated copies of numbers for strtod, grown to fit the longest so far
+  char *scratch;
+  size_t scratchCapacity;
+} Input;
+
+// Punctuation carries no data, so one token of each kind serves every use.
+// They live outside the heap.
+Item openToken = {.type = OPEN_TYPE, .s = "("};
+Item closeToken = {.type = CLOSE_TYPE, .s = ")"};
+Item openBracketToken = {.type = OPENBRACKET_TYPE, .s = "["};
+Item closeBracketToken = {.type = CLOSEBRACKET_TYPE, .s = "]"};
+Item dotToken = {.type = DOT_TYPE, .s = "."};
+Item quoteToken = {.type = SINGLEQUOTE_TYPE, .s = "'"};
+Item openVectorToken = {.type = OPENVECTOR_TYPE, .s = "#("};
+
+//prints syntax error message then ends the evaluation
 void error(char *message) {
-  printf("Syntax error: %s\n", message);
-  texit(1);
+  fprintf(context->output, "Syntax error: %s\n", message);
+  abandon();
+}
+
+// makes the context's input a new one, closing any it had
+Input *newInput() {
+  closeInput();
+  Input *in = calloc(1, sizeof(Input));
+  if(in == NULL) {
+    printf("Error: out of memory\n");
+    texit(1);
+  }
+  context->input = in;
+  return in;
+}
+
+// Takes input from the file at path, or from stdin if path is NULL, mapping
+// it into memory if it is a regular file.
+void openInput(const char *path) {
+  Input *in = newInput();
+  if(path != NULL) {
+    in->path = strdup(path);
+    if(in->path == NULL) {
+      printf("Error: out of memory\n");
+      texit(1);
+    }
+    in->file = open(path, O_RDONLY);
+    if(in->file < 0) {
+      fprintf(context->output, "Error: could not open %s\n", path);
+      abandon();
+    }
+  }
+  struct stat info;
+  if(fstat(in->file, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+    void *map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, in->file, 0);
+    if(map != MAP_FAILED) {
+      in->text = map;
+      in->length = info.st_size;
+      in->mapped = true;
+    }
+  }
+}
+
+void openString(const char *text) {
+  Input *in = newInput();
+  in->length = in->capacity = strlen(text);
+  in->text = malloc(in->length + 1);
+  if(in->text == NULL) {
+    printf("Error: out of memory\n");
+    texit(1);
+  }
+  memcpy(in->text, text, in->length);
+  in->ended = true;
+}
+
+void freeInput(Input *in) {
+  if(in == NULL)
+    return;
+  if(in->mapped)
+    munmap(in->text, in->length);
+  else
+    free(in->text);
+  if(in->file > 0)
+    close(in->file);
+  free(in->scratch);
+  free(in->path);
+  free(in);
+}
+
+void closeInput() {
+  freeInput(context->input);
+  context->input = NULL;
+}
+
+const char *mappedInput(const char **path, size_t *length) {
+  Input *in = context->input;
+  if(in == NULL || !in->mapped || in->path == NULL)
+    return NULL;
+  *path = in->path;
+  *length = in->length;
+  return in->text;
+}
+
+// reads more input into the buffer, first dropping everything before the
+// current token; returns false if there is no more
+bool refill(Input *in) {
+  if(in->mapped || in->ended)
+    return false;
+  if(in->tokenStart > 0) {
+    memmove(in->text, in->text + in->tokenStart, in->length - in->tokenStart);
+    in->length -= in->tokenStart;
+    in->position -= in->tokenStart;
+    in->tokenStart = 0;
+  }
+  if(in->length == in->capacity) {
+    in->capacity = in->capacity ? 2 * in->capacity : READ_SIZE;
+    in->text = realloc(in->text, in->capacity);
+    if(in->text == NULL) {
+      printf("Error: out of memory\n");
+      texit(1);
+    }
+  }
+  // futures may go on allocating, and so collecting, while this thread waits
+  // for more input
+  tpark();
+  ssize_t count = read(in->file, in->text + in->length, in->capacity - in->length);
+  tunpark();
+  if(count <= 0) {
+    in->ended = true;
+    return false;
+  }
+  in->length += count;
+  return true;
+}
+
+// returns the next character of the input, or EOF at the end
+static inline int readChar(Input *in) {
+  if(in->position == in->length && !refill(in))
+    return EOF;
+  return (unsigned char)in->text[in->position++];
+}
+
+// steps back over c, the last character read, as ungetc does
+static inline void unreadChar(Input *in, int c) {
+  if(c != EOF)
+    in->position--;
 }
 
 //returns 1 if c is a delimiter in our grammar (if c could denote the end of a
@@ -35,83 +200,92 @@ int isInitial(char c) {//initials for symbols
 }
 
 
-// Read all of the input from stdin, and returns a linked list where each car
-// points to a token.
-Item *tokenize() {
-    int charRead;
-    Item *list = makeNull();
-    charRead = fgetc(stdin);
+// Reads the next token from the input and returns it, or returns NULL at the
+// end of the input. No more input is read than the token needs (apart from
+// the delimiter after it, which is put back), so a caller can act on each
+// token as soon as it is typed. Symbols and numbers are read straight out of
+// the input buffer without being copied.
+Item *nextToken() {
+    if(context->input == NULL)
+      openInput(NULL);
+    Input *in = context->input;
+    in->tokenStart = in->position;
+    int charRead = readChar(in);
 
-    while (charRead != EOF) {
+    for (;;) {
       if(isspace(charRead)) {//if we encounter whitespace
-        charRead = fgetc(stdin);//keep moving till it's something else
+        in->tokenStart = in->position;
+        charRead = readChar(in);//keep moving till it's something else
         continue;
       }
         //matching comments
       if (charRead == ';') {
         while(charRead != '\n' && charRead != EOF) {
-          charRead=fgetc(stdin);
+          in->tokenStart = in->position;
+          charRead=readChar(in);
         }
-      if(charRead==EOF) break;
       continue;
       }
+      if(charRead==EOF) return NULL;
+      in->tokenStart = in->position - 1;
+
 
 
+      //matching opening and closing delims, and quotes
+      if (charRead == '(')
+        return &openToken;
+      if (charRead == ')')
+        return &closeToken;
+      if (charRead == '[')
+        return &openBracketToken;
+      if (charRead == ']')
+        return &closeBracketToken;
+      if (charRead == '\'')
+        return &quoteToken;
+
+      //a dot on its own marks the cdr of a pair
+      if (charRead == '.') {
+        int next = readChar(in);
+        unreadChar(in, next);
+        if (isDelim(next))
+          return &dotToken;
+      }
 
-      Item *token=makeNull();//there should be something to tokenize, lets make
-                             //a placeholder for that token
-
-      //matching opening and closing delims
-      if (charRead == '(') {
-        token->type=OPEN_TYPE;
-        token->s=talloc(2*sizeof(char));
-        sprintf(token->s,"%c",charRead);
-      } else if (charRead == ')') {
-        token->type=CLOSE_TYPE;
-        token->s=talloc(2*sizeof(char));
-        sprintf(token->s,"%c",charRead);
-      } else if (charRead == '[') {
-        token->type=OPENBRACKET_TYPE;
-        token->s=talloc(2*sizeof(char));
-        sprintf(token->s,"%c",charRead);
-      } else if (charRead == ']') {
-        token->type=CLOSEBRACKET_TYPE;
-        token->s=talloc(2*sizeof(char));
-        sprintf(token->s,"%c",charRead);
+      Item *token = NULL;//symbols are interned, booleans and integers are immediates
 
         //matching strings
-      } else if (charRead == '\"') {
-        token->type=STR_TYPE;
-        char *temp_string=talloc(sizeof(char)*(TOKEN_LENGTH_LIMIT+1));
+      if (charRead == '\"') {
+        token=makeItem(STR_TYPE);
         int i=0;
-        while(i<TOKEN_LENGTH_LIMIT) {//fill in the temporary string
-          charRead=fgetc(stdin);
+        for(;;) {//find the end of the string
+          charRead=readChar(in);
           if(charRead=='\"' || charRead ==EOF) break;//have we reached the end?
-          temp_string[i]=charRead;
           i++;
         }
         if(charRead==EOF) error("unexpected end of input while reading string");
-        if(i==TOKEN_LENGTH_LIMIT) error("string longer than limit of 300 characters");
-        temp_string[i]='\0';//so we finish the string
-        token->s=temp_string;
-        charRead=fgetc(stdin);
+        charRead=readChar(in);
         if(!isDelim(charRead)) error("No delimiter after string");
-        ungetc(charRead,stdin);
+        unreadChar(in, charRead);
+        // the input is freed once read, so the string is copied out
+        token->s=talloc(sizeof(char)*(i+1));
+        memcpy(token->s,in->text+in->tokenStart+1,i);
+        token->s[i]='\0';
 
         //matching booleans
       } else if (charRead == '#') {
-        token->type=BOOL_TYPE;
-        charRead=fgetc(stdin);
+        charRead=readChar(in);
+        if(charRead=='(')
+          return &openVectorToken;
         if(charRead=='f') {
-          token->i=0;
+          token=FALSE_ITEM;
         } else if(charRead=='t') {
-          token->i=1;
+          token=TRUE_ITEM;
         } else {
           error("Invalid boolean syntax");
         }
-        charRead=fgetc(stdin);
+        charRead=readChar(in);
         if(!isDelim(charRead)) error("no delimiter after string");
-        ungetc(charRead,stdin);
+        unreadChar(in, charRead);
 
         // match number or + - sign
         } else if(charRead == '+' || charRead == '-' || isdigit(charRead) || charRead == '.') {
@@ -120,69 +294,62 @@ Item *tokenize() {
 
             if(charRead == '+' || charRead == '-') {
                 sign = charRead;
-                charRead = fgetc(stdin);
+                charRead = readChar(in);
 
                 // check if +- is a symbol
                 if(isDelim(charRead) || charRead == EOF) {
-                   
-                    token->type = SYMBOL_TYPE;
-                    token->s = talloc(sizeof(int)*2);
-                    sprintf(token->s, "%c", sign);
-
-                    list = cons(token, list);
-                    continue;
+                    unreadChar(in, charRead);
+                    return internSpan(in->text + in->tokenStart, 1);
                 }
             }
 
-            char *num = talloc(sizeof(char)*(TOKEN_LENGTH_LIMIT+1));
-            if(sign) {
-              num[0] = sign;//sign initialized to zero, then maybe changed to
-                            //'+' or '-'. In that case we put it in num[0]
-            }
-
             bool sawPoint = false;
             int i = (sign ? 1 : 0);
-            while(i < TOKEN_LENGTH_LIMIT) {
-                if(isdigit(charRead)) {
-                    num[i] = charRead;
-                } else if(charRead == '.' && !sawPoint) {
-                    num[i] = charRead;
+            for(;;) {
+                if(charRead == '.' && !sawPoint) {
                     sawPoint = true;
-                } else {
+                } else if(!isdigit(charRead)) {
                     error("invalid characters in number");
                 }
-                charRead = fgetc(stdin);
+                charRead = readChar(in);
                 if(isDelim(charRead)) break;
                 i++;
             }
             // currently charRead is delim or EOF. Step back so it will be the same at beginning of next loop
-            ungetc(charRead, stdin);
-
-            // need space for null terminator
-            if(i == TOKEN_LENGTH_LIMIT) error("number exceeds character limit");
-
-            // null terminate
-            num[i+1] = '\0';
+            unreadChar(in, charRead);
 
             // number can't consist of only decimal point
             if(i == (sign ? 1:0) && sawPoint)
               error("invalid number is just a decimal point");
 
+            // the number is the i+1 characters at the start of the token
+            char *text = in->text + in->tokenStart;
             if(sawPoint) {
-                token->type = DOUBLE_TYPE;
-                token->d = strtod(num,NULL);
+                // strtod needs a terminated copy
+                if(in->scratchCapacity < (size_t)i + 2) {
+                    in->scratchCapacity = 2 * (i + 2);
+                    in->scratch = realloc(in->scratch, in->scratchCapacity);
+                    if(in->scratch == NULL) error("out of memory");
+                }
+                memcpy(in->scratch, text, i+1);
+                in->scratch[i+1] = '\0';
+                token = makeItem(DOUBLE_TYPE);
+                token->d = strtod(in->scratch,NULL);
+            } else if(i + 1 - (sign ? 1 : 0) > 18) {
+                // too many digits to be sure of fitting in a fixnum
+                token = integerFromDecimal(text + (sign ? 1 : 0), i + 1 - (sign ? 1 : 0), sign == '-');
             } else {
-                token->type = INT_TYPE;
-                token->i = strtol(num,NULL,10);
+                long value = 0;
+                for(int digit = (sign ? 1 : 0); digit <= i; digit++)
+                    value = 10 * value + (text[digit] - '0');
+                token = makeInt(sign == '-' ? -value : value);
             }
 
         //matching symbols (besides + or -)
       } else if (isInitial(charRead))//matching initials
         {
-          token->type=SYMBOL_TYPE;
-          char *temp_symbol=talloc(sizeof(char)*(TOKEN_LENGTH_LIMIT+1));
           int i;
-          for(i=0; i<TOKEN_LENGTH_LIMIT; i++) {
+          for(i=0;; i++) {
             if(!(isInitial(charRead)
                  || isdigit(charRead)
                  || charRead=='.'
@@ -190,51 +357,15 @@ Item *tokenize() {
                  || charRead=='-')) {
               error("invalid characters in symbol");
             }
-            temp_symbol[i]=charRead;
-            charRead=fgetc(stdin);
+            charRead=readChar(in);
             if(isDelim(charRead)) {
-              ungetc(charRead,stdin);
+              unreadChar(in, charRead);
               break;
             }
           }
-        if(i==TOKEN_LENGTH_LIMIT) error("symbol exceeds character limit");
-        temp_symbol[i+1]='\0';//so we finish the symbol
-        token->s=temp_symbol;
+        token=internSpan(in->text+in->tokenStart,i+1);//copied once when interned
         } else error("invalid token");
 
-      list=cons(token,list);
-      charRead = fgetc(stdin);
+      return token;
     }
-
-
-    Item *revList = reverse(list);
-    return revList;
-}
-
-//prints the tokens stored in list to stdout, as value:type
-void displayTokens(Item *list) {
-  while(list->type==CONS_TYPE) {
-    Item *token=list->c.car;
-    if(token->type==STR_TYPE)
-      printf("\"%s\":string\n",token->s);
-    if(token->type==SYMBOL_TYPE)
-      printf("%s:symbol\n",token->s);
-    if(token->type==OPEN_TYPE)
-      printf("%s:open\n",token->s);
-    if(token->type==CLOSE_TYPE)
-      printf("%s:close\n",token->s);
-    if(token->type==OPENBRACKET_TYPE)
-      printf("%s:openbracket\n",token->s);
-    if(token->type==CLOSEBRACKET_TYPE)
-      printf("%s:closebracket\n",token->s);
-    if(token->type==INT_TYPE)
-      printf("%i:integer\n",token->i);
-    if(token->type==DOUBLE_TYPE)
-      printf("%lf:double\n",token->d);
-    if(token->type==BOOL_TYPE)
-      printf("#%c:boolean\n",token->i? 't':'f');
-    if(token->type==NULL_TYPE)
-      printf("null:null\n");
-    list=cdr(list);//move to next item in list
-  }
 }
@@ -1,13 +1,29 @@
+#include <stddef.h>
 #include "item.h"
 
 #ifndef TOKENIZER_H
 #define TOKENIZER_H
 
-// Read all of the input from stdin, and return a linked list consisting of the
-// tokens.
-Item *tokenize();
+// The current context's input is read from one of these.
+struct Input;
 
-// Displays the contents of the linked list as tokens, with type information
-void displayTokens(Item *list);
+// Take the program from the file at path, or from stdin if path is NULL.
+// Without a call to this, input comes from stdin.
+void openInput(const char *path);
+
+// Take the program from a copy of text.
+void openString(const char *text);
+
+// Stop reading the current context's input, and free an input.
+void closeInput();
+void freeInput(struct Input *input);
+
+// Returns the text of the current input if it is a whole file mapped into
+// memory, setting path and length to the file's, or else NULL.
+const char *mappedInput(const char **path, size_t *length);
+
+// Read the next token from the input and return it, or NULL at the end of the
+// input. Punctuation tokens are shared and must not be modified.
+Item *nextToken();
 
 #endif
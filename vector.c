@@ -0,0 +1,138 @@
+#include <limits.h>
+#include <string.h>
+#include "item.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "vector.h"
+
+Item *makeVector(int length, Item *fill) {
+  Item *vector = makeItem(VECTOR_TYPE);
+  vector->vec.elements = tallocObject(length * sizeof(Item *), POINTERS_OBJECT);
+  vector->vec.length = length;
+  for (int i = 0; i < length; i++)
+    vector->vec.elements[i] = fill;
+  return vector;
+}
+
+Item *listToVector(Item *list) {
+  int count = 0;
+  Item *rest = list;
+  for (; typeOf(rest) == CONS_TYPE; rest = cdr(rest))
+    count++;
+  if (typeOf(rest) != NULL_TYPE)
+    evaluationError("list->vector requires a proper list");
+  Item *vector = makeVector(count, makeNull());
+  for (int i = 0; i < count; i++, list = cdr(list))
+    vector->vec.elements[i] = car(list);
+  return vector;
+}
+
+Item *vectorToList(Item *vector) {
+  Item *list = makeNull();
+  for (int i = vector->vec.length - 1; i >= 0; i--)
+    list = cons(vector->vec.elements[i], list);
+  return list;
+}
+
+// returns argument, checking it is a vector
+Item *vectorArgument(Item *argument, char *message) {
+  if (typeOf(argument) != VECTOR_TYPE)
+    evaluationError(message);
+  return argument;
+}
+
+// returns index, checking it is in the vector
+int indexArgument(Item *vector, Item *index, char *message) {
+  if (typeOf(index) != INT_TYPE || intValue(index) < 0 || intValue(index) >= vector->vec.length)
+    evaluationError(message);
+  return intValue(index);
+}
+
+Item *primitiveMakeVector(int argc, Item **argv) {
+  Item *size = argv[0];
+  if (typeOf(size) != INT_TYPE || intValue(size) < 0 || intValue(size) > INT_MAX / (int)sizeof(Item *))
+    evaluationError("make-vector requires a valid size");
+  return makeVector(intValue(size), argc == 2 ? argv[1] : makeInt(0));
+}
+
+Item *primitiveVector(int argc, Item **argv) {
+  Item *vector = makeVector(argc, makeNull());
+  memcpy(vector->vec.elements, argv, argc * sizeof(Item *));
+  return vector;
+}
+
+Item *primitiveVectorRef(int argc, Item **argv) {
+  Item *vector = vectorArgument(argv[0], "vector-ref requires a vector as first argument");
+  return vector->vec.elements[indexArgument(vector, argv[1], "vector-ref index out of range")];
+}
+
+Item *primitiveVectorSet(int argc, Item **argv) {
+  Item *vector = vectorArgument(argv[0], "vector-set! requires a vector as first argument");
+  vector->vec.elements[indexArgument(vector, argv[1], "vector-set! index out of range")] = argv[2];
+  return VOID_ITEM;
+}
+
+Item *primitiveVectorLength(int argc, Item **argv) {
+  return makeInt(vectorArgument(argv[0], "vector-length requires a vector")->vec.length);
+}
+
+Item *primitiveVectorFill(int argc, Item **argv) {
+  Item *vector = vectorArgument(argv[0], "vector-fill! requires a vector as first argument");
+  for (int i = 0; i < vector->vec.length; i++)
+    vector->vec.elements[i] = argv[1];
+  return VOID_ITEM;
+}
+
+Item *primitiveVectorToList(int argc, Item **argv) {
+  return vectorToList(vectorArgument(argv[0], "vector->list requires a vector"));
+}
+
+Item *primitiveListToVector(int argc, Item **argv) {
+  return listToVector(argv[0]);
+}
+
+// returns true if less says a comes before b
+static bool before(Item *less, Item *a, Item *b) {
+  Item *pair[2] = {a, b};
+  return apply(less, 2, pair) != FALSE_ITEM;
+}
+
+// Sorts the vector in place with a bottom-up merge sort, which is stable and
+// calls less O(n log n) times whatever order the elements start in. Runs are
+// merged back and forth between the elements and a scratch array.
+Item *primitiveVectorSort(int argc, Item **argv) {
+  // both SRFI 132's (vector-sort! v <) and R6RS's (vector-sort! < v) work
+  Item *vector = argv[0];
+  Item *less = argv[1];
+  if (typeOf(vector) != VECTOR_TYPE) {
+    vector = argv[1];
+    less = argv[0];
+  }
+  if (typeOf(vector) != VECTOR_TYPE
+      || (typeOf(less) != CLOSURE_TYPE && typeOf(less) != PRIMITIVE_TYPE))
+    evaluationError("vector-sort! requires a vector and a procedure");
+
+  int n = vector->vec.length;
+  Item **from = vector->vec.elements;
+  Item **to = tallocObject(n * sizeof(Item *), POINTERS_OBJECT);
+  for (int width = 1; width < n; width *= 2) {
+    for (int low = 0; low < n; low += 2 * width) {
+      int middle = low + width < n ? low + width : n;
+      int high = low + 2 * width < n ? low + 2 * width : n;
+      int i = low, j = middle, k = low;
+      while (i < middle && j < high)
+        to[k++] = before(less, from[j], from[i]) ? from[j++] : from[i++];
+      while (i < middle)
+        to[k++] = from[i++];
+      while (j < high)
+        to[k++] = from[j++];
+    }
+    Item **swap = from;
+    from = to;
+    to = swap;
+  }
+  if (from != vector->vec.elements)
+    memcpy(vector->vec.elements, from, n * sizeof(Item *));
+  return VOID_ITEM;
+}
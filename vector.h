@@ -0,0 +1,24 @@
+#include "item.h"
+
+#ifndef VECTOR_H
+#define VECTOR_H
+
+// Makes a vector of length elements, each set to fill.
+Item *makeVector(int length, Item *fill);
+
+// Converts between vectors and proper lists.
+Item *listToVector(Item *list);
+Item *vectorToList(Item *vector);
+
+// The vector primitives, bound by globalEnvironment.
+Item *primitiveMakeVector(int argc, Item **argv);
+Item *primitiveVector(int argc, Item **argv);
+Item *primitiveVectorRef(int argc, Item **argv);
+Item *primitiveVectorSet(int argc, Item **argv);
+Item *primitiveVectorLength(int argc, Item **argv);
+Item *primitiveVectorFill(int argc, Item **argv);
+Item *primitiveVectorToList(int argc, Item **argv);
+Item *primitiveListToVector(int argc, Item **argv);
+Item *primitiveVectorSort(int argc, Item **argv);
+
+#endif
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <string.h>
+#include "item.h"
+#include "linkedlist.h"
+#include "talloc.h"
+#include "interpreter.h"
+#include "compiler.h"
+#include "vm.h"
+#include "context.h"
+
+// The state of a call waiting for a callee to return: its code, where it is
+// in that code, its frame, and the stack index the callee's value goes to. A
+// record with no code marks the point where a run of the VM returns to C.
+typedef struct CallRecord {
+  Item *code;
+  Frame *frame;
+  int pc;
+  int base;
+} CallRecord;
+
+_Thread_local VMStacks *stacks = NULL;
+
+// allocates the stacks the first time the VM runs on them
+void initVM() {
+  if (stacks->stack != NULL)
+    return;
+  troot(&stacks->stack);
+  troot(&stacks->calls);
+  stacks->stackCapacity = 1024;
+  stacks->stack = tallocObject(stacks->stackCapacity * sizeof(Item *), POINTERS_OBJECT);
+  stacks->callCapacity = 256;
+  stacks->calls = tallocObject(stacks->callCapacity * sizeof(CallRecord), POINTERS_OBJECT);
+}
+
+// makes room for needed more values above stackTop
+void reserveStack(int needed) {
+  if (stacks->stackTop + needed <= stacks->stackCapacity)
+    return;
+  while (stacks->stackTop + needed > stacks->stackCapacity)
+    stacks->stackCapacity *= 2;
+  Item **grown = tallocObject(stacks->stackCapacity * sizeof(Item *), POINTERS_OBJECT);
+  memcpy(grown, stacks->stack, stacks->stackTop * sizeof(Item *));
+  stacks->stack = grown;
+}
+
+// saves the state of a call
+void pushCall(Item *code, Frame *frame, int pc, int base) {
+  if (stacks->callTop == stacks->callCapacity) {
+    stacks->callCapacity *= 2;
+    CallRecord *grown = tallocObject(stacks->callCapacity * sizeof(CallRecord), POINTERS_OBJECT);
+    memcpy(grown, stacks->calls, stacks->callTop * sizeof(CallRecord));
+    stacks->calls = grown;
+  }
+  stacks->calls[stacks->callTop++] = (CallRecord){code, frame, pc, base};
+}
+
+// returns true if value counts as false in a test
+static inline bool isFalse(Item *value) {
+  return value == FALSE_ITEM;
+}
+
+// makes a list of the argc values at args
+Item *argumentList(Item **args, int argc) {
+  Item *list = makeNull();
+  for (int i = argc - 1; i >= 0; i--)
+    list = cons(args[i], list);
+  return list;
+}
+
+// makes the frame for a call of a compiled closure with the argc values at
+// args, which fill the first slots of the frame
+Frame *argumentFrame(Item *function, Item **args, int argc) {
+  Frame *frame = makeFrame(function->cl.frame, function->cl.functionCode->cd.frameSize);
+  Item *params = function->cl.paramNames;
+  if (typeOf(params) == SYMBOL_TYPE) {
+    // variable length args
+    frame->slots[0] = argumentList(args, argc);
+  } else if (typeOf(params) == CONS_TYPE) {
+    int slot = 0;
+    while (slot < argc && typeOf(params) == CONS_TYPE) {
+      frame->slots[slot] = args[slot];
+      slot++;
+      params = cdr(params);
+    }
+    if (slot < argc)
+      evaluationError("too many arguments given");
+    if (typeOf(params) == CONS_TYPE)
+      evaluationError("not enough arguments given");
+  } else if (typeOf(params) != NULL_TYPE) {
+    evaluationError("invalid parameter names");
+  }
+  return frame;
+}
+
+// calls anything but a compiled closure: a primitive, or a closure for the
+// tree-walking evaluator
+Item *callOut(Item *function, Item **args, int argc) {
+  if (typeOf(function) == PRIMITIVE_TYPE)
+    return callPrimitive(function, argc, args);
+  if (typeOf(function) == CLOSURE_TYPE)
+    return apply(function, argc, args);
+  evaluationError("first thing in list wasn't a function or special form");
+  return makeNull();
+}
+
+// returns true if function is a closure compiled for the VM
+static inline bool isCompiled(Item *function) {
+  return typeOf(function) == CLOSURE_TYPE && typeOf(function->cl.functionCode) == CODE_TYPE;
+}
+
+// Runs code in frame and returns its value. sp points just above the top
+// value; stackTop is brought up to date before anything that might start
+// another run or grow the stack, and sp reloaded after.
+Item *run(Item *code, Frame *frame) {
+  reserveStack(code->cd.maxStack);
+  pushCall(NULL, NULL, 0, stacks->stackTop);
+  Item **sp = stacks->stack + stacks->stackTop;
+  int *ops = code->cd.ops;
+  int *pc = ops + CODE_HEADER;
+  Item **constants = code->cd.constants;
+  Item *value;
+  Frame *target;
+  int argc;
+
+#define SAVE() (stacks->stackTop = sp - stacks->stack)
+#define RELOAD() (sp = stacks->stack + stacks->stackTop)
+  // switches to the code of a compiled closure, making sure the stack has
+  // room for it
+#define ENTER(function)                                     \
+  do {                                                      \
+    code = (function)->cl.functionCode;                     \
+    ops = code->cd.ops;                                     \
+    pc = ops + CODE_HEADER;                                 \
+    constants = code->cd.constants;                         \
+    if (sp + code->cd.maxStack > stacks->stack + stacks->stackCapacity) { \
+      SAVE();                                               \
+      reserveStack(code->cd.maxStack);                      \
+      RELOAD();                                             \
+    }                                                       \
+  } while (0)
+  // sets target to the frame a depth operand refers to
+#define ADDRESS()                                           \
+  do {                                                      \
+    target = frame;                                         \
+    for (int depth = *pc++; depth > 0; depth--)             \
+      target = target->parent;                              \
+  } while (0)
+
+#ifdef __GNUC__
+  // computed goto: each instruction jumps straight to the next one's handler
+#define OPCODE_LABEL(op) &&label_##op,
+  static void *labels[] = { OPCODES(OPCODE_LABEL) };
+#undef OPCODE_LABEL
+#define CASE(op) label_##op:
+#define NEXT goto *labels[*pc++]
+  NEXT;
+#else
+#define CASE(op) case op:
+#define NEXT continue
+  for (;;) switch (*pc++) {
+#endif
+
+  CASE(OP_CONST)
+    *sp++ = constants[*pc++];
+    NEXT;
+  CASE(OP_LOCAL)
+    ADDRESS();
+    value = target->slots[*pc++];
+    if (value == NULL)
+      evaluationError("unbound variable");
+    *sp++ = value;
+    NEXT;
+  CASE(OP_LOCAL0)
+    value = frame->slots[*pc++];
+    if (value == NULL)
+      evaluationError("unbound variable");
+    *sp++ = value;
+    NEXT;
+  CASE(OP_GLOBAL)
+    value = constants[pc[1]];
+    if (value->c.cdr != makeInt(context->globalVersion)) {
+      long version = context->globalVersion;
+      Item *callee = lookupGlobal(constants[pc[0]]);
+      if (value->c.car == callee) {
+        value->c.cdr = makeInt(version);
+      } else {
+        value = cons(callee, makeInt(version));
+        publish(&constants[pc[1]], value);
+      }
+    }
+    *sp++ = value->c.car;
+    pc += 2;
+    NEXT;
+  CASE(OP_SET_LOCAL)
+    ADDRESS();
+    target->slots[*pc++] = sp[-1];
+    sp[-1] = VOID_ITEM;
+    NEXT;
+  CASE(OP_STORE_LOCAL)
+    ADDRESS();
+    target->slots[*pc++] = *--sp;
+    NEXT;
+  CASE(OP_SET_GLOBAL)
+    setGlobal(constants[*pc++], sp[-1]);
+    sp[-1] = VOID_ITEM;
+    NEXT;
+  CASE(OP_DEFINE_GLOBAL)
+    defineGlobal(constants[*pc++], sp[-1]);
+    sp[-1] = VOID_ITEM;
+    NEXT;
+  CASE(OP_POP)
+    sp--;
+    NEXT;
+  CASE(OP_VOID)
+    *sp++ = VOID_ITEM;
+    NEXT;
+  CASE(OP_JUMP)
+    pc = ops + *pc;
+    NEXT;
+  CASE(OP_TEST_IF)
+    value = *--sp;
+    if (typeOf(value) != BOOL_TYPE)
+      evaluationError("conditional in if didn't evaluate to bool");
+    pc = boolValue(value) ? pc + 1 : ops + *pc;
+    NEXT;
+  CASE(OP_JUMP_IF_FALSE)
+    value = *--sp;
+    pc = isFalse(value) ? ops + *pc : pc + 1;
+    NEXT;
+  CASE(OP_AND_JUMP)
+    if (isFalse(sp[-1])) {
+      pc = ops + *pc;
+    } else {
+      sp--;
+      pc++;
+    }
+    NEXT;
+  CASE(OP_OR_JUMP)
+    if (!isFalse(sp[-1])) {
+      pc = ops + *pc;
+    } else {
+      sp--;
+      pc++;
+    }
+    NEXT;
+  CASE(OP_CLOSURE)
+    value = makeItem(CLOSURE_TYPE);
+    value->cl.frame = frame;
+    value->cl.functionCode = constants[*pc++];
+    value->cl.paramNames = value->cl.functionCode->cd.constants[0];
+    *sp++ = value;
+    NEXT;
+  CASE(OP_CALL)
+    argc = *pc++;
+    value = sp[-argc - 1];
+    if (isCompiled(value)) {
+      target = argumentFrame(value, sp - argc, argc);
+      sp -= argc + 1;
+      pushCall(code, frame, pc - ops, sp - stacks->stack);
+      frame = target;
+      ENTER(value);
+      NEXT;
+    }
+    SAVE();
+    value = callOut(value, sp - argc, argc);
+    RELOAD();
+    sp -= argc;
+    sp[-1] = value;
+    NEXT;
+  CASE(OP_TAIL_CALL)
+    argc = *pc++;
+    value = sp[-argc - 1];
+    if (isCompiled(value)) {
+      // the callee takes over this call's record, so it returns straight
+      // to this call's caller
+      frame = argumentFrame(value, sp - argc, argc);
+      sp = stacks->stack + stacks->calls[stacks->callTop - 1].base;
+      ENTER(value);
+      NEXT;
+    }
+    SAVE();
+    value = callOut(value, sp - argc, argc);
+    RELOAD();
+    goto doReturn;
+  CASE(OP_RETURN)
+    value = sp[-1];
+  doReturn: {
+    CallRecord *caller = &stacks->calls[--stacks->callTop];
+    sp = stacks->stack + caller->base;
+    if (caller->code == NULL) {
+      stacks->stackTop = caller->base;
+      return value;
+    }
+    code = caller->code;
+    ops = code->cd.ops;
+    pc = ops + caller->pc;
+    constants = code->cd.constants;
+    frame = caller->frame;
+    *sp++ = value;
+    NEXT;
+  }
+  CASE(OP_ENTER_FRAME)
+    target = makeFrame(frame, *pc++);
+    argc = *pc++;
+    sp -= argc;
+    for (int slot = 0; slot < argc; slot++)
+      target->slots[slot] = sp[slot];
+    frame = target;
+    NEXT;
+  CASE(OP_FILL)
+    argc = *pc++;
+    sp -= argc;
+    for (int slot = 0; slot < argc; slot++)
+      frame->slots[slot] = sp[slot];
+    NEXT;
+  CASE(OP_LEAVE_FRAME)
+    frame = frame->parent;
+    NEXT;
+  CASE(OP_SET_CAR)
+    value = *--sp;
+    if (typeOf(sp[-1]) != CONS_TYPE)
+      evaluationError("set-car! requires CONS cell as first input");
+    sp[-1]->c.car = value;
+    sp[-1] = VOID_ITEM;
+    NEXT;
+  CASE(OP_SET_CDR)
+    value = *--sp;
+    if (typeOf(sp[-1]) != CONS_TYPE)
+      evaluationError("set-cdr! requires CONS cell as first input");
+    sp[-1]->c.cdr = value;
+    sp[-1] = VOID_ITEM;
+    NEXT;
+  CASE(OP_FAIL)
+    evaluationError(constants[*pc]->s);
+    return makeNull();
+
+#ifndef __GNUC__
+  default:
+    evaluationError("bad instruction");
+  }
+#endif
+#undef SAVE
+#undef RELOAD
+#undef ENTER
+#undef ADDRESS
+#undef CASE
+#undef NEXT
+}
+
+Item *vmApply(Item *function, int argc, Item **argv) {
+  initVM();
+  Frame *frame = argumentFrame(function, argv, argc);
+  return run(function->cl.functionCode, frame);
+}
+
+void vmInterpret(Item *tree) {
+  initVM();
+  Frame *frame = globalEnvironment();
+  while (typeOf(tree) == CONS_TYPE) {
+    printResult(run(compile(car(tree)), frame));
+    tree = cdr(tree);
+  }
+}
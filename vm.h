@@ -0,0 +1,65 @@
+#include "item.h"
+
+#ifndef VM_H
+#define VM_H
+
+// The VM's instructions. Each is an int in a Code's ops array, followed by
+// its operands; jump targets are offsets into the same array.
+#define OPCODES(X)                                                         \
+    X(OP_CONST)          /* k: push constants[k] */                        \
+    X(OP_LOCAL)          /* depth slot: push a variable */                 \
+    X(OP_LOCAL0)         /* slot: push a variable of the current frame */  \
+    X(OP_GLOBAL)         /* k c: push the global named by constants[k], */ \
+                         /* cached in the pair constants[c] */             \
+    X(OP_SET_LOCAL)      /* depth slot: pop into a variable, push void */  \
+    X(OP_STORE_LOCAL)    /* depth slot: pop into a variable */             \
+    X(OP_SET_GLOBAL)     /* k: pop, rebind a global, push void */          \
+    X(OP_DEFINE_GLOBAL)  /* k: pop, bind a global, push void */            \
+    X(OP_POP)            /* discard the top value */                       \
+    X(OP_VOID)           /* push void */                                   \
+    X(OP_JUMP)           /* target */                                      \
+    X(OP_TEST_IF)        /* target: pop a boolean, jump if #f */           \
+    X(OP_JUMP_IF_FALSE)  /* target: pop, jump if #f */                     \
+    X(OP_AND_JUMP)       /* target: jump if the top is #f, else pop */     \
+    X(OP_OR_JUMP)        /* target: jump if the top is not #f, else pop */ \
+    X(OP_CLOSURE)        /* k: push a closure of the code constants[k] */  \
+    X(OP_CALL)           /* argc: call the function below the arguments */ \
+    X(OP_TAIL_CALL)      /* argc: call, replacing the current call */      \
+    X(OP_RETURN)         /* return the top value to the caller */          \
+    X(OP_ENTER_FRAME)    /* size count: new frame, pop count into it */    \
+    X(OP_FILL)           /* count: pop count values into the frame */      \
+    X(OP_LEAVE_FRAME)    /* return to the enclosing frame */               \
+    X(OP_SET_CAR)        /* pop value and pair, set the car, push void */  \
+    X(OP_SET_CDR)        /* pop value and pair, set the cdr, push void */  \
+    X(OP_FAIL)           /* k: evaluation error with message constants[k] */
+
+#define OPCODE_ENUM(op) op,
+typedef enum { OPCODES(OPCODE_ENUM) OPCODE_COUNT } opcode;
+#undef OPCODE_ENUM
+
+// The value stack and call stack, shared by every run of the VM in a thread
+// so that a run started from inside another (through apply) carries on above
+// it. Both are heap objects whose every word is traced, allocated the first
+// time the VM runs and grown by doubling. Each thread running in a context
+// has stacks of its own.
+typedef struct VMStacks {
+  struct Item **stack;
+  int stackTop;
+  int stackCapacity;
+  struct CallRecord *calls;
+  int callTop;
+  int callCapacity;
+} VMStacks;
+
+// The stacks the calling thread's VM runs on.
+extern _Thread_local VMStacks *stacks;
+
+// Compiles each analysed top-level expression to bytecode and runs it on the
+// VM, printing the results as interpret does.
+void vmInterpret(Item *tree);
+
+// Calls a closure compiled for the VM with the argc arguments at argv and
+// returns its value.
+Item *vmApply(Item *function, int argc, Item **argv);
+
+#endif